@@ -21,26 +21,58 @@
  */
 
 #include <algorithm>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <unordered_set>
 
 #include "autocomplete.hpp"
 
 namespace clang_autocomplete {
 Nan::Persistent<v8::Function> autocomplete::constructor;
 
-autocomplete::autocomplete() : mArgs(), mIndex(nullptr) {
+autocomplete::autocomplete() : mArgs(), mIndex(nullptr), mExpiration(30), mPolicy(cache_policy::idle), mLimit(0),
+        mDeliveryScheduled(false), mNotify(new uv_async_t)
+{
         // create the clang index: excludeDeclarationsFromPCH = 1, displayDiagnostics = 1
         mIndex = clang_createIndex(1, 1);
 
+        // Diagnostics are delivered from the event loop, the handle must not keep node alive
+        uv_async_init(uv_default_loop(), mNotify, DeliverDiagnostics);
+        uv_unref(reinterpret_cast<uv_handle_t*>(mNotify));
+        mNotify->data = this;
+
+        mShared.set_policy(std::unique_ptr<eviction_policy>(new lru_policy(16)));
+
+        applyPolicy();
+
         // If an object is purged from the cache, dispose it's translation unit
-        mCache.set_purge_callback([] (std::string K, CXTranslationUnit V)noexcept {
-                        clang_disposeTranslationUnit(V);
+        mCache.set_purge_callback([this] (const std::string& K, cached_unit& V)noexcept {
+                        trace_scope span(mTracer, "dispose", K);
+                        retractDiagnostics(K);
+                        clang_disposeTranslationUnit(V.unit);
+                });
+
+        // A unit parsed concurrently with another request for the same file, the cached one stays
+        mCache.set_reject_callback([] (cached_unit& V)noexcept {
+                        clang_disposeTranslationUnit(V.unit);
                 });
 }
 
 autocomplete::~autocomplete() {
+        // Nobody is left to receive the diagnostics of the disposed units
+        mDiagnosticsCb.reset();
+
+        // translation units have to be disposed before the index they belong to
+        mCache.clear();
         clang_disposeIndex(mIndex);
+
+        mNotify->data = nullptr;
+        uv_close(reinterpret_cast<uv_handle_t*>(mNotify), [](uv_handle_t* handle) {
+                delete reinterpret_cast<uv_async_t*>(handle);
+        });
 }
 
 NAN_METHOD(autocomplete::New) {
@@ -61,9 +93,12 @@ NAN_MODULE_INIT(autocomplete::Init) {
         tpl->InstanceTemplate()->SetInternalFieldCount(1);
         tpl->SetClassName(Nan::New("lib").ToLocalChecked());
 
-        // Accessor for args and cache_expiration
+        // Accessor for args, cache settings and tracing
         Nan::SetAccessor(tpl->InstanceTemplate(), Nan::New("arguments").ToLocalChecked(), GetArgs, SetArgs);
         Nan::SetAccessor(tpl->InstanceTemplate(), Nan::New("cache_expiration").ToLocalChecked(), GetCacheExpiration, SetCacheExpiration);
+        Nan::SetAccessor(tpl->InstanceTemplate(), Nan::New("cache_policy").ToLocalChecked(), GetCachePolicy, SetCachePolicy);
+        Nan::SetAccessor(tpl->InstanceTemplate(), Nan::New("cache_limit").ToLocalChecked(), GetCacheLimit, SetCacheLimit);
+        Nan::SetAccessor(tpl->InstanceTemplate(), Nan::New("tracing").ToLocalChecked(), GetTracing, SetTracing);
 
         // Make our methods available to Node
         Nan::SetPrototypeMethod(tpl, "version", Version);
@@ -71,6 +106,16 @@ NAN_MODULE_INIT(autocomplete::Init) {
         Nan::SetPrototypeMethod(tpl, "diagnose", Diagnose);
         Nan::SetPrototypeMethod(tpl, "memoryUsage", MemoryUsage);
         Nan::SetPrototypeMethod(tpl, "clearCache", ClearCache);
+        Nan::SetPrototypeMethod(tpl, "prefetch", Prefetch);
+        Nan::SetPrototypeMethod(tpl, "open", Open);
+        Nan::SetPrototypeMethod(tpl, "edit", Edit);
+        Nan::SetPrototypeMethod(tpl, "close", Close);
+        Nan::SetPrototypeMethod(tpl, "definition", Definition);
+        Nan::SetPrototypeMethod(tpl, "typeAt", TypeAt);
+        Nan::SetPrototypeMethod(tpl, "hover", Hover);
+        Nan::SetPrototypeMethod(tpl, "subscribe", Subscribe);
+        Nan::SetPrototypeMethod(tpl, "unsubscribe", Unsubscribe);
+        Nan::SetPrototypeMethod(tpl, "writeTrace", WriteTrace);
 
         Nan::SetPrototypeMethod(tpl, "Version", Version);
         Nan::SetPrototypeMethod(tpl, "Complete", Complete);
@@ -97,6 +142,7 @@ NAN_SETTER(autocomplete::SetArgs) {
         autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
         instance->mArgs.clear();
         instance->mCache.clear();
+        instance->mShared.clear();
 
         if (value->IsArray()) {
                 // If we get multiple arguments, clear the list and append them all
@@ -115,405 +161,1589 @@ NAN_SETTER(autocomplete::SetArgs) {
                 instance->mArgs.push_back(*str);
         } else {
                 Nan::ThrowTypeError("First argument must be a String or an Array");
-                return;
         }
+
+        instance->mIncludes.set_args(instance->mArgs, detail::to_string(clang_getClangVersion()));
 }
 
 NAN_GETTER(autocomplete::GetCacheExpiration) {
         autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
-        info.GetReturnValue().Set(Nan::New(instance->mCache.get_expiration()));
+        info.GetReturnValue().Set(Nan::New(instance->mExpiration));
 }
 
 NAN_SETTER(autocomplete::SetCacheExpiration) {
         autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
 
         if (value->IsUint32()) {
-                instance->mCache.set_expiration(value->Uint32Value());
+                instance->mExpiration = value->Uint32Value();
+                if (instance->mPolicy == cache_policy::idle)
+                        instance->applyPolicy();
         } else {
                 Nan::ThrowTypeError("First argument must be an Integer");
                 return;
         }
 }
 
-NAN_METHOD(autocomplete::Version) {
-        CXString clang_v = clang_getClangVersion();
+NAN_GETTER(autocomplete::GetCachePolicy) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
 
-        std::string ver = std::string("0.3.2 (clang-autocomplete); ")+std::string(clang_getCString(clang_v));
-        clang_disposeString(clang_v);
+        const char* name = "idle";
+        if (instance->mPolicy == cache_policy::lru)
+                name = "lru";
+        else if (instance->mPolicy == cache_policy::memory)
+                name = "memory";
 
-        info.GetReturnValue().Set(Nan::New(ver.c_str()).ToLocalChecked());
+        info.GetReturnValue().Set(Nan::New(name).ToLocalChecked());
 }
 
-NAN_METHOD(autocomplete::Complete) {
-        // Check if the fuction is called correctly
-        if (info.Length() != 3) {
-                Nan::ThrowSyntaxError("Usage: filename, row, column");
+NAN_SETTER(autocomplete::SetCachePolicy) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
+
+        if (!value->IsString()) {
+                Nan::ThrowTypeError("First argument must be a String");
                 return;
         }
 
-        if (!info[0]->IsString()) {
-                Nan::ThrowSyntaxError("First argument must be a String");
+        v8::String::Utf8Value str(value);
+        std::string name(*str, str.length());
+        if (name == "idle") {
+                instance->mPolicy = cache_policy::idle;
+        } else if (name == "lru") {
+                instance->mPolicy = cache_policy::lru;
+        } else if (name == "memory") {
+                instance->mPolicy = cache_policy::memory;
+        } else {
+                Nan::ThrowRangeError("Cache policy must be one of idle, lru or memory");
                 return;
         }
 
-        if (!info[1]->IsUint32()) {
-                Nan::ThrowSyntaxError("Second argument must be an Integer");
+        instance->applyPolicy();
+}
+
+NAN_GETTER(autocomplete::GetCacheLimit) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
+        info.GetReturnValue().Set(Nan::New(instance->mLimit));
+}
+
+NAN_SETTER(autocomplete::SetCacheLimit) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
+
+        if (value->IsUint32()) {
+                instance->mLimit = value->Uint32Value();
+                if (instance->mPolicy != cache_policy::idle)
+                        instance->applyPolicy();
+        } else {
+                Nan::ThrowTypeError("First argument must be an Integer");
                 return;
         }
+}
 
-        if (!info[2]->IsUint32()) {
-                Nan::ThrowSyntaxError("Third argument must be an Integer");
+NAN_GETTER(autocomplete::GetTracing) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
+        info.GetReturnValue().Set(Nan::New(static_cast<uint32_t>(instance->mTracer.get_capacity())));
+}
+
+NAN_SETTER(autocomplete::SetTracing) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.Holder());
+
+        if (value->IsUint32()) {
+                instance->mTracer.set_capacity(value->Uint32Value());
+        } else {
+                Nan::ThrowTypeError("First argument must be an Integer");
                 return;
         }
+}
 
-        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+NAN_METHOD(autocomplete::Version) {
+        CXString clang_v = clang_getClangVersion();
 
-        v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+        std::string ver = std::string("0.3.2 (clang-autocomplete); ")+std::string(clang_getCString(clang_v));
+        clang_disposeString(clang_v);
 
-        // Convert string vector to a const char* vector for clang_parseTranslationUnit
-        std::vector<const char*> cArgs;
-        std::transform( instance->mArgs.begin(), instance->mArgs.end(), std::back_inserter(cArgs),
-                        [](const std::string &s) -> const char* {
-                        return s.c_str();
-                }
-                        );
+        info.GetReturnValue().Set(Nan::New(ver.c_str()).ToLocalChecked());
+}
 
-        v8::String::Utf8Value file(info[0]);
-        uint32_t row = info[1]->ToUint32()->Value();
-        uint32_t col = info[2]->ToUint32()->Value();
+/** Decodes the chunks of a completion string into c, returns false if the result should be dropped */
+typedef bool (*decode_fn)(CXCompletionString str, completion_buffer& buf, completion& c);
+
+/** Maps a cursor kind to the type reported to node and the function decoding it */
+struct completion_decoder {
+        /** Cursor kind handled */
+        CXCursorKind kind;
+        /** Completion type, e.g. "function" */
+        const char* type;
+        /** Decoder */
+        decode_fn decode;
+};
+
+/** Returns the text of a completion chunk */
+template <typename F>
+static void chunkText(CXCompletionString str, uint32_t chunk, F fcn) {
+        CXString cText = clang_getCompletionChunkText(str, chunk);
+        const char *text = clang_getCString(cText);
+        fcn(text ? text : "");
+        clang_disposeString(cText);
+}
 
-        // The completion options
-        unsigned options = CXTranslationUnit_PrecompiledPreamble | CXTranslationUnit_CacheCompletionResults;
+/** Declarations: functions, records, variables, macros, ... */
+static bool decodeDeclaration(CXCompletionString str, completion_buffer& buf, completion& c) {
+        uint32_t chunks = clang_getNumCompletionChunks(str);
 
-        CXTranslationUnit trans;
-        std::string sFile(*file, file.length());
-        if (instance->mCache.has(sFile)) {
-                // reparsing saves a moderate amount of time
-                trans = instance->mCache.get(sFile);
-                clang_reparseTranslationUnit(trans, 0, NULL, 0);
-        } else {
-                //trans = clang_parseTranslationUnit(instance->mIndex, *file, &cArgs[0], cArgs.size(), NULL, 0, options);
-                if (CXErrorCode err = clang_parseTranslationUnit2(instance->mIndex, *file, &cArgs[0], cArgs.size(), NULL, 0, options, &trans)) {
-                        // TODO: process error
-                        Nan::ThrowError("Unable to build translation unit");
-                        return;
+        for (uint32_t k = 0; k < chunks; ++k) {
+                switch (clang_getCompletionChunkKind(str, k)) {
+                case CXCompletionChunk_ResultType:
+                        chunkText(str, k, [&](const char* text) { c.result = buf.intern(text); });
+                        break;
+
+                case CXCompletionChunk_TypedText:
+                        chunkText(str, k, [&](const char* text) { c.name = buf.append(text); });
+                        break;
+
+                case CXCompletionChunk_Placeholder:
+                        chunkText(str, k, [&](const char* text) { buf.params.push_back(buf.intern(text)); });
+                        break;
+
+                case CXCompletionChunk_Informative:
+                        // does not seem to propagate noexcept, etc.
+                        chunkText(str, k, [&](const char* text) { buf.qualifiers.push_back(buf.intern(text)); });
+                        break;
+
+                default:
+                        break;
                 }
+        }
+
+        return c.name.length != 0;
+}
 
-                instance->mCache.insert(sFile, trans);
+/** Enum constants, described by their parent enum */
+static bool decodeEnumConstant(CXCompletionString str, completion_buffer& buf, completion& c) {
+        if (!decodeDeclaration(str, buf, c))
+                return false;
+
+        CXString parent = clang_getCompletionParent(str, NULL);
+        const char* text = clang_getCString(parent);
+        c.result = buf.intern(text ? text : "");
+        clang_disposeString(parent);
+
+        uint32_t mark = buf.mark();
+        buf.append("enum ");
+        if (c.result.length) {
+                buf.append(c.result);
+                buf.append("::");
         }
+        buf.append(c.name);
+        c.description = buf.since(mark);
 
-        // Check if we were able to build the translation unit
-        if (!trans) {
-                Nan::ThrowError("Unable to build translation unit");
-                return;
+        return true;
+}
+
+/** Sometimes points to the current parameter */
+static bool decodeCurrentParameter(CXCompletionString str, completion_buffer& buf, completion& c) {
+        uint32_t chunks = clang_getNumCompletionChunks(str);
+
+        for (uint32_t k = 0; k < chunks; ++k) {
+                if (clang_getCompletionChunkKind(str, k) == CXCompletionChunk_CurrentParameter)
+                        chunkText(str, k, [&](const char* text) { c.name = buf.append(text); });
         }
 
-        // Iterate over the code completion results
-        CXCodeCompleteResults *res = clang_codeCompleteAt(trans, *file, row, col, NULL, 0, 0);
+        return c.name.length != 0;
+}
+
+/** All cursor kinds we report, anything else is skipped */
+static const completion_decoder decoders[] = {
+        {CXCursor_StructDecl,           "def",          decodeDeclaration},
+        {CXCursor_UnionDecl,            "def",          decodeDeclaration},
+        {CXCursor_ClassDecl,            "def",          decodeDeclaration},
+        {CXCursor_EnumDecl,             "def",          decodeDeclaration},
+        {CXCursor_ClassTemplate,        "def",          decodeDeclaration},
+        {CXCursor_ObjCInterfaceDecl,    "def",          decodeDeclaration},
+        {CXCursor_EnumConstantDecl,     "enum_member",  decodeEnumConstant},
+        {CXCursor_FunctionDecl,         "function",     decodeDeclaration},
+        {CXCursor_FunctionTemplate,     "function",     decodeDeclaration},
+        {CXCursor_CXXMethod,            "method",       decodeDeclaration},
+        {CXCursor_ConversionFunction,   "method",       decodeDeclaration},
+        {CXCursor_Constructor,          "constructor",  decodeDeclaration},
+        {CXCursor_Destructor,           "destructor",   decodeDeclaration},
+        {CXCursor_MacroDefinition,      "macro",        decodeDeclaration},
+        {CXCursor_VarDecl,              "variable",     decodeDeclaration},
+        {CXCursor_ParmDecl,             "variable",     decodeDeclaration},
+        {CXCursor_FieldDecl,            "member",       decodeDeclaration},
+        {CXCursor_TypedefDecl,          "typedef",      decodeDeclaration},
+        {CXCursor_TypeAliasDecl,        "typedef",      decodeDeclaration},
+        {CXCursor_Namespace,            "namespace",    decodeDeclaration},
+        {CXCursor_NamespaceAlias,       "namespace",    decodeDeclaration},
+        {CXCursor_NotImplemented,       "current",      decodeCurrentParameter}
+};
+
+/** Returns the decoder for kind or nullptr if it isn't reported */
+static const completion_decoder* findDecoder(CXCursorKind kind) {
+        // dense lookup table indexed by cursor kind, built once
+        static const std::vector<const completion_decoder*> index = [] {
+                std::vector<const completion_decoder*> ret;
+                for (const completion_decoder& d : decoders) {
+                        if (static_cast<std::size_t>(d.kind) >= ret.size())
+                                ret.resize(d.kind + 1, nullptr);
+
+                        ret[d.kind] = &d;
+                }
 
+                return ret;
+        }();
+
+        return static_cast<std::size_t>(kind) < index.size() ? index[kind] : nullptr;
+}
+
+void autocomplete::decode(CXCodeCompleteResults* res, completion_buffer& buf) {
+        buf.clear();
 
-        uint32_t j = 0;
         for (unsigned i = 0; i < res->NumResults; ++i) {
+                const CXCompletionResult& r = res->Results[i];
+
                 // skip unessecary completion results
-                if (clang_getCompletionAvailability(res->Results[i].CompletionString) == CXAvailability_NotAccessible)
+                if (clang_getCompletionAvailability(r.CompletionString) == CXAvailability_NotAccessible)
                         continue;
 
-                v8::Local<v8::Object> rObj = Nan::New<v8::Object>();
-                v8::Local<v8::Array> rArgs = Nan::New<v8::Array>();
-                v8::Local<v8::Array> rQualifiers = Nan::New<v8::Array>();
-
-                uint32_t results = clang_getNumCompletionChunks(res->Results[i].CompletionString);
-
-                std::string cName = "";
-                std::string cType = "";
-                std::string cDescription = "";
-                std::string cReturnType = "";
-                std::string cParam = "";
-
-                // Populate result
-                uint32_t l = 0;
-                uint32_t m = 0;
-                for (uint32_t k = 0; k < results; ++k) {
-                        CXCompletionChunkKind cKind = clang_getCompletionChunkKind(res->Results[i].CompletionString, k);
-
-                        // Get the completion chunk text
-                        CXString cText = clang_getCompletionChunkText(res->Results[i].CompletionString, k);
-                        const char *text = clang_getCString(cText);
-                        if (!text)
-                                text = "";
-
-                        // Switch on the completion type
-                        switch (res->Results[i].CursorKind) {
-                        // class / union / struct / enum
-                        case CXCursor_UnionDecl:
-                        case CXCursor_ClassDecl:
-                        case CXCursor_StructDecl:
-                        case CXCursor_EnumDecl:
-                                cType = "def";
-                                cName = text; // struct only emits text once
-                                cDescription = std::string(instance->returnType(res->Results[i].CursorKind)) + " " + cName;
-                                break;
+                const completion_decoder* decoder = findDecoder(r.CursorKind);
+                if (!decoder)
+                        continue;
 
-                        // enum completion
-                        case CXCursor_EnumConstantDecl:
-                                if (cKind == CXCompletionChunk_ResultType) {
-                                        cReturnType = ""; // parent enum
-                                        cDescription = std::string("enum ") + cReturnType + "::" + cName;
-                                } else {
-                                        cName = text; // variable
-                                        cType = "enum_member";
-                                }
-                                break;
+                completion c = {decoder->type, {0, 0}, {0, 0}, {0, 0},
+                        static_cast<uint32_t>(buf.params.size()), 0, static_cast<uint32_t>(buf.qualifiers.size()), 0};
 
-                        // a single function decleration
-                        case CXCursor_FunctionDecl:
-                                switch (cKind) {
-                                case CXCompletionChunk_ResultType:
-                                        cType = "function";
-                                        cReturnType = text; // function return type;
-                                        break;
-
-                                case CXCompletionChunk_TypedText:
-                                        cName = text; // function name
-                                        break;
-
-                                case CXCompletionChunk_Placeholder:
-                                        rArgs->Set(l++, Nan::New(text).ToLocalChecked());
-                                        break;
-
-                                default:
-                                        break;
-                                }
-                                break;
+                if (!decoder->decode(r.CompletionString, buf, c)) {
+                        buf.params.resize(c.first_param);
+                        buf.qualifiers.resize(c.first_qualifier);
+                        continue;
+                }
 
-                        // a variable
-                        case CXCursor_VarDecl:
-                                if (cKind == CXCompletionChunk_ResultType) {
-                                        cReturnType = text; // type
-                                } else {
-                                        cName = text; // variable
-                                        cType = "variable";
-                                }
-                                break;
+                c.num_params = buf.params.size() - c.first_param;
+                c.num_qualifiers = buf.qualifiers.size() - c.first_qualifier;
+
+                // Describe the remaining declarations by their kind, e.g. "class foo"
+                const char* kind = returnType(r.CursorKind);
+                if (!c.description.length && *kind) {
+                        uint32_t mark = buf.mark();
+                        buf.append(kind);
+                        buf.append(" ");
+                        buf.append(c.name);
+                        c.description = buf.since(mark);
+                }
 
-                        // typedef
-                        case CXCursor_TypedefDecl:
-                                cName = text;
-                                cType = "typedef";
-                                break;
+                buf.results.push_back(c);
+        }
+}
 
-                        // class member function
-                        case CXCursor_CXXMethod:
-                                switch (cKind) {
-                                case CXCompletionChunk_ResultType:
-                                        cType = "method";
-                                        cReturnType = text; // function return type;
-                                        break;
-
-                                case CXCompletionChunk_TypedText:
-                                        cName = text; // function name
-                                        break;
-
-                                case CXCompletionChunk_Placeholder:
-                                        rArgs->Set(l++, Nan::New(text).ToLocalChecked());
-                                        break;
-
-                                case CXCompletionChunk_Informative:
-                                        rQualifiers->Set(m++, Nan::New(text).ToLocalChecked()); // does not seem to propagate noexcept, etc.
-                                        break;
-
-                                default:
-                                        break;
-                                }
-                                break;
+bool autocomplete::completeCode(const std::string& file, uint32_t row, uint32_t col, completion_buffer& buf) {
+        // clang_codeCompleteAt parses the main file of open documents by itself. As long as their preamble
+        // is unchanged there is no need to reparse first, unless someone waits for diagnostics.
+        unit_cache::handle trans;
+        auto doc = mDocuments.find(file);
+        if (doc != mDocuments.end() && !mDiagnosticsCb) {
+                trans = mCache.get(file);
+                if (trans && (trans->tier != parse_tier::full || trans->preamble != doc->second.preamble_revision()))
+                        trans.reset();
+        }
 
-                        // class member variable
-                        case CXCursor_FieldDecl:
-                                if (cKind == CXCompletionChunk_ResultType) {
-                                        cReturnType = text; // type
-                                } else {
-                                        cName = text; // variable
-                                        cType = "member";
-                                }
-                                break;
+        if (!trans)
+                trans = translationUnit(file);
 
-                        // namespace
-                        case CXCursor_Namespace:
-                                if (cKind == CXCompletionChunk_TypedText) {
-                                        cType = "namespace";
-                                        cName = text;
-                                }
-                                break;
+        // Check if we were able to build the translation unit
+        if (!trans) {
+                Nan::ThrowError("Unable to build translation unit");
+                return false;
+        }
 
-                        // class constructor
-                        case CXCursor_Constructor:
-                                switch (cKind) {
-                                case CXCompletionChunk_TypedText:
-                                        cName = text; // class name
-                                        cType = "constructor";
-                                        break;
-
-                                case CXCompletionChunk_Placeholder:
-                                        rArgs->Set(l++, Nan::New(text).ToLocalChecked());
-                                        break;
-
-                                case CXCompletionChunk_Informative:
-                                        rQualifiers->Set(m++, Nan::New(text).ToLocalChecked()); // does not seem to propagate noexcept
-                                        break;
-
-                                default:
-                                        break;
-                                }
-                                break;
+        // Iterate over the code completion results
+        std::vector<CXUnsavedFile> unsaved = unsavedFiles();
+        if (completeShared(file, *trans, row, col, unsaved, buf))
+                return true;
+
+        CXCodeCompleteResults *res;
+        {
+                trace_scope span(mTracer, "codeComplete", file);
+                res = clang_codeCompleteAt(trans->unit, file.c_str(), row, col, unsaved.data(), unsaved.size(), CXCodeComplete_IncludeMacros);
+        }
 
-                        // Sometimes points to the current parameter
-                        case CXCursor_NotImplemented:
-                                if (cKind == CXCompletionChunk_CurrentParameter) {
-                                        cType = "current";
-                                        cName = text;
-                                }
-                                break;
+        if (!res) {
+                Nan::ThrowError("Unable to complete code");
+                return false;
+        }
 
-                        // default
-                        default:
-                                clang_disposeString(cText);
-                                continue;
-                        }
+        {
+                trace_scope span(mTracer, "decode", file);
+                decode(res, buf);
+        }
 
-                        clang_disposeString(cText);
-                }
+        clang_disposeCodeCompleteResults(res);
+
+        return true;
+}
 
-                if (cType != "") {
-                        rObj->Set(Nan::New("name").ToLocalChecked(), Nan::New(cName.c_str()).ToLocalChecked());
-                        rObj->Set(Nan::New("type").ToLocalChecked(), Nan::New(cType.c_str()).ToLocalChecked());
-                        rObj->Set(Nan::New("return").ToLocalChecked(), Nan::New(cReturnType.c_str()).ToLocalChecked());
-                        rObj->Set(Nan::New("description").ToLocalChecked(), Nan::New(cDescription.c_str()).ToLocalChecked());
-                        rObj->Set(Nan::New("params").ToLocalChecked(), rArgs);
-                        rObj->Set(Nan::New("qualifiers").ToLocalChecked(), rQualifiers);
+#if CINDEX_VERSION_MINOR >= 50
+/** Seconds between checks whether the headers of shared completions changed */
+static const time_t sharedCheckInterval = 5;
 
-                        ret->Set(j++, rObj);
-                }
+/** FNV-1a, continuing from hash */
+static uint64_t hashBytes(const char* data, std::size_t len, uint64_t hash = 14695981039346656037ull) {
+        for (std::size_t i = 0; i < len; ++i) {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 1099511628211ull;
         }
 
-        clang_disposeCodeCompleteResults(res);
+        return hash;
+}
 
-        info.GetReturnValue().Set(ret);
+/** Identifies a completion when merging shared and local results, overloads only differ in their parameters */
+static std::string completionKey(const completion_buffer& buf, const completion& c) {
+        std::string ret(c.type);
+        auto append = [&buf, &ret](string_ref str) {
+                ret += '\0';
+                ret.append(buf.data(str), str.length);
+        };
+
+        append(c.name);
+        append(c.result);
+        append(c.description);
+
+        for (uint32_t i = 0; i < c.num_params; ++i)
+                append(buf.params[c.first_param + i]);
+
+        // the parameters end here, otherwise a parameter could pass for a qualifier
+        ret += '\1';
+        for (uint32_t i = 0; i < c.num_qualifiers; ++i)
+                append(buf.qualifiers[c.first_qualifier + i]);
+
+        return ret;
 }
 
-NAN_METHOD(autocomplete::Diagnose) {
-        // Check if the fuction is called correctly
-        if (info.Length() != 1) {
-                Nan::ThrowSyntaxError("Usage: filename");
+/** Collects all included files but the main file */
+static void collectInclusions(CXFile file, CXSourceLocation*, unsigned depth, CXClientData data) {
+        if (!depth)
                 return;
+
+        auto* files = static_cast<std::vector<std::pair<std::string, time_t>>*>(data);
+        files->emplace_back(detail::to_string(clang_getFileName(file)), clang_getFileTime(file));
+}
+
+/** Returns whether c can be part of an identifier */
+static bool isIdentifier(char c) {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/** Returns line row (1-based) of text */
+static std::string textLine(const char* text, std::size_t size, uint32_t row) {
+        const char* end = text + size;
+        for (uint32_t i = 1; i < row && text < end; ++i) {
+                const char* eol = static_cast<const char*>(memchr(text, '\n', end - text));
+                text = eol ? eol + 1 : end;
         }
 
-        if (!info[0]->IsString()) {
-                Nan::ThrowSyntaxError("First argument must be an String");
-                return;
+        const char* eol = static_cast<const char*>(memchr(text, '\n', end - text));
+        std::string ret(text, eol ? eol : end);
+        if (!ret.empty() && ret.back() == '\r')
+                ret.pop_back();
+
+        return ret;
+}
+
+/**
+ * Checks if col of line follows a qualifier such as "std::" or "::", returns the qualifying names.
+ *
+ * Qualifiers following a member access or a template argument list are rejected, they don't name a namespace.
+ */
+static bool qualifierAt(const std::string& line, uint32_t col, std::vector<std::string>& names) {
+        if (col == 0 || col - 1 > line.size())
+                return false;
+
+        auto skipSpace = [&line](std::size_t i) {
+                while (i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t'))
+                        --i;
+                return i;
+        };
+
+        // skip the part of the name typed so far
+        std::size_t i = col - 1;
+        while (i > 0 && isIdentifier(line[i - 1]))
+                --i;
+
+        names.clear();
+        bool qualified = false;
+
+        for (i = skipSpace(i); i >= 2 && line[i - 1] == ':' && line[i - 2] == ':'; i = skipSpace(i)) {
+                qualified = true;
+
+                std::size_t end = skipSpace(i - 2);
+                for (i = end; i > 0 && isIdentifier(line[i - 1]); --i) {}
+
+                // a leading :: refers to the global namespace
+                if (i == end)
+                        break;
+
+                names.insert(names.begin(), line.substr(i, end - i));
         }
 
-        // Create the local scope and get the instance
-        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        i = skipSpace(i);
+        return qualified && (i == 0 || (line[i - 1] != '.' && line[i - 1] != '>'));
+}
 
-        // Convert string vector to a const char* vector for clang_parseTranslationUnit
-        std::vector<const char*> cArgs;
-        std::transform( instance->mArgs.begin(), instance->mArgs.end(), std::back_inserter(cArgs),
-                        [](const std::string &s) -> const char* {
-                        return s.c_str();
+/** Checks if names is a namespace declared in a header, members of inline namespaces are found through their parent */
+static bool isNamespace(CXTranslationUnit unit, const std::vector<std::string>& names) {
+        struct lookup {
+                const std::string* name;
+                std::vector<CXCursor>* scopes;
+                std::vector<CXCursor> found;
+        };
+
+        // Namespaces are reopened by many headers, each block is a cursor of its own
+        std::vector<CXCursor> scopes(1, clang_getTranslationUnitCursor(unit));
+        for (const std::string& name : names) {
+                lookup data = {&name, &scopes, {}};
+
+                for (std::size_t i = 0; i < scopes.size(); ++i) {
+                        clang_visitChildren(scopes[i], [](CXCursor c, CXCursor, CXClientData d) {
+                                lookup* l = static_cast<lookup*>(d);
+                                if (clang_getCursorKind(c) != CXCursor_Namespace ||
+                                        clang_Location_isFromMainFile(clang_getCursorLocation(c)))
+                                        return CXChildVisit_Continue;
+
+                                if (detail::to_string(clang_getCursorSpelling(c)) == *l->name)
+                                        l->found.push_back(c);
+                                else if (clang_Cursor_isInlineNamespace(c))
+                                        l->scopes->push_back(c);
+
+                                return CXChildVisit_Continue;
+                        }, &data);
                 }
-                        );
 
-        v8::Local<v8::Array> ret = Nan::New<v8::Array>();
-        v8::String::Utf8Value file(info[0]);
+                if (data.found.empty())
+                        return false;
 
-        // Don't cache diagnostics
-        unsigned options = CXTranslationUnit_PrecompiledPreamble | clang_defaultDiagnosticDisplayOptions();
-        CXTranslationUnit trans = clang_parseTranslationUnit(instance->mIndex, *file, &cArgs[0], cArgs.size(), NULL, 0, options);
+                scopes.swap(data.found);
+        }
 
-        if (!trans) {
-                Nan::ThrowError("Unable to build translation unit");
-                return;
+        return true;
+}
+
+/**
+ * Returns the USR of the namespace row of the main file is in, false if it is inside a class.
+ *
+ * opening receives the declarations reopening the namespace, e.g. "namespace a { inline namespace b { ".
+ */
+static bool enclosingNamespace(CXTranslationUnit unit, uint32_t row, std::string& usr, std::string& opening) {
+        struct search {
+                uint32_t row;
+                CXCursor found;
+        };
+
+        usr.clear();
+        opening.clear();
+        CXCursor scope = clang_getTranslationUnitCursor(unit);
+
+        for (;;) {
+                search data = {row, clang_getNullCursor()};
+                clang_visitChildren(scope, [](CXCursor c, CXCursor, CXClientData d) {
+                        search* s = static_cast<search*>(d);
+                        CXSourceRange range = clang_getCursorExtent(c);
+                        if (!clang_Location_isFromMainFile(clang_getRangeStart(range)))
+                                return CXChildVisit_Continue;
+
+                        unsigned first, last;
+                        clang_getExpansionLocation(clang_getRangeStart(range), nullptr, &first, nullptr, nullptr);
+                        clang_getExpansionLocation(clang_getRangeEnd(range), nullptr, &last, nullptr, nullptr);
+                        if (first > s->row || last < s->row)
+                                return CXChildVisit_Continue;
+
+                        s->found = c;
+                        return CXChildVisit_Break;
+                }, &data);
+
+                if (clang_Cursor_isNull(data.found))
+                        return true;
+
+                CXCursorKind parent;
+                switch (clang_getCursorKind(data.found)) {
+                case CXCursor_Namespace:
+                        usr = detail::to_string(clang_getCursorUSR(data.found));
+                        opening += clang_Cursor_isInlineNamespace(data.found) ? "inline namespace " : "namespace ";
+                        opening += detail::to_string(clang_getCursorSpelling(data.found)) + " { ";
+                        scope = data.found;
+                        break;
+                case CXCursor_LinkageSpec:
+                        scope = data.found;
+                        break;
+                case CXCursor_FunctionDecl:
+                case CXCursor_FunctionTemplate:
+                case CXCursor_VarDecl:
+                        // out of line definitions of members can access everything their class can
+                        parent = clang_getCursorKind(clang_getCursorSemanticParent(data.found));
+                        return parent == CXCursor_Namespace || parent == CXCursor_TranslationUnit || parent == CXCursor_LinkageSpec;
+                default:
+                        return false;
+                }
+        }
+}
+#endif
+
+bool autocomplete::sharedKey(const std::string& file, const cached_unit& trans, uint32_t row, uint32_t col,
+        shared_position& pos)
+{
+#if CINDEX_VERSION_MINOR >= 50
+        // The scope is looked up in the unit, open documents skipping the reparse are ahead of it
+        auto doc = mDocuments.find(file);
+        if (doc != mDocuments.end() && doc->second.version() != trans.version)
+                return false;
+
+        // The unit keeps the text it was parsed from, no need to read the file again
+        CXFile main = clang_getFile(trans.unit, file.c_str());
+        std::size_t size = 0;
+        const char* text = main ? clang_getFileContents(trans.unit, main, &size) : nullptr;
+        if (!text)
+                return false;
+
+        std::string line = textLine(text, size, row);
+        if (!qualifierAt(line, col, pos.names))
+                return false;
+
+        // The qualifier is looked up from the enclosing namespace
+        std::string scope, opening;
+        if (!enclosingNamespace(trans.unit, row, scope, opening))
+                return false;
+
+        pos.key = 14695981039346656037ull;
+        for (auto& arg : mArgs)
+                pos.key = hashBytes(arg.c_str(), arg.size() + 1, pos.key);
+
+        std::size_t preamble = document::preamble_length(text, size);
+        pos.key = hashBytes(text, preamble, pos.key);
+
+        // quoted includes are resolved relative to the file
+        if (memchr(text, '"', preamble)) {
+                std::size_t slash = file.rfind('/');
+                pos.key = hashBytes(file.data(), slash == std::string::npos ? 0 : slash, pos.key);
         }
 
-        int dOpt = 0;
+        pos.key = hashBytes(scope.c_str(), scope.size() + 1, pos.key);
+        for (auto& name : pos.names)
+                pos.key = hashBytes(name.c_str(), name.size() + 1, pos.key);
 
-        // iterate through diagnostics
-        uint32_t j = 0;
-        for (uint32_t i = 0; i < clang_getNumDiagnostics(trans); ++i) {
-                CXDiagnostic d = clang_getDiagnostic(trans, i);
+        // clang's preamble extends up to the first token, the precompiled one is only reused if it is identical
+        std::size_t code = preamble;
+        while (code < size && (text[code] == ' ' || text[code] == '\t'))
+                ++code;
 
-                // get diagnostic warning
-                CXString str = clang_formatDiagnostic(d, dOpt);
+        std::string qualifier;
+        for (auto& name : pos.names)
+                qualifier += name + "::";
 
-                // get diagnostic location
-                CXString file;
-                unsigned line;
-                unsigned col;
-                CXSourceLocation loc = clang_getDiagnosticLocation(d);
-                clang_getPresumedLocation(loc, &file, &line, &col);
+        if (pos.names.empty())
+                qualifier = "::";
 
-                // propagate to node
-                v8::Local<v8::Array> diagnostics = Nan::New<v8::Array>();
-                diagnostics->Set(0, Nan::New(clang_getCString(file)).ToLocalChecked());
-                diagnostics->Set(1, Nan::New(line));
-                diagnostics->Set(2, Nan::New(col));
-                diagnostics->Set(3, Nan::New(clang_getCString(str)).ToLocalChecked());
-                diagnostics->Set(4, Nan::New(clang_getDiagnosticSeverity(d)));
+        pos.source.assign(text, code);
+        pos.row = std::count(pos.source.begin(), pos.source.end(), '\n') + 2;
+        pos.col = qualifier.size() + 1;
 
-                ret->Set(j++, diagnostics);
+        pos.source += opening + "void clang_autocomplete_shared() {\n" + qualifier + "\n}";
+        for (std::size_t i = std::count(opening.begin(), opening.end(), '{'); i > 0; --i)
+                pos.source += " }";
 
-                clang_disposeString(file);
-                clang_disposeString(str);
-                clang_disposeDiagnostic(d);
+        pos.source += "\n";
+        return true;
+#else
+        return false;
+#endif
+}
+
+bool autocomplete::completeShared(const std::string& file, cached_unit& trans, uint32_t row, uint32_t col,
+        std::vector<CXUnsavedFile>& unsaved, completion_buffer& buf)
+{
+#if CINDEX_VERSION_MINOR >= 50
+        shared_position pos;
+        if (!sharedKey(file, trans, row, col, pos))
+                return false;
+
+        CXTranslationUnit unit = trans.unit;
+        shared_cache::handle shared = mShared.get(pos.key);
+
+        // Headers changing on disk invalidate the shared results, they are only checked now and then
+        time_t now = time(NULL);
+        if (shared && now - shared->checked >= sharedCheckInterval) {
+                struct stat st;
+                for (auto& f : shared->files) {
+                        if (stat(f.first.c_str(), &st) != 0 || st.st_mtime != f.second) {
+                                shared.reset();
+                                mShared.remove(pos.key);
+                                break;
+                        }
+                }
+
+                if (shared)
+                        shared->checked = now;
         }
 
-        info.GetReturnValue().Set(ret);
-}
+        // Sharing a miss takes an additional completion, only spend it on namespaces declared in headers
+        if (!shared && !isNamespace(unit, pos.names))
+                return false;
 
-NAN_METHOD(autocomplete::MemoryUsage) {
-        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        // Without a precompiled preamble, skipping it returns everything, reparse once to build it
+        if (!trans.precompiled) {
+                trace_scope span(mTracer, "precompile", file);
+                clang_reparseTranslationUnit(unit, unsaved.size(), unsaved.data(), 0);
+                trans.precompiled = true;
+        }
 
-        v8::Local<v8::Array> ret = Nan::New<v8::Array>();
-        uint32_t j = 0;
+        // Complete the symbols of the file itself, declarations sharing a name with them come along from the preamble
+        CXCodeCompleteResults *res;
+        {
+                trace_scope span(mTracer, "codeCompleteLocal", file);
+                res = clang_codeCompleteAt(unit, file.c_str(), row, col, unsaved.data(), unsaved.size(),
+                        CXCodeComplete_IncludeMacros | CXCodeComplete_SkipPreamble);
+        }
+
+        if (!res)
+                return false;
 
-        for (auto &e : instance->mCache) {
-                CXTranslationUnit unit = e.second.value;
-                CXTUResourceUsage res = clang_getCXTUResourceUsage(unit);
-                uint32_t all = 0;
+        unsigned long long contexts = clang_codeCompleteGetContexts(res);
+        decode(res, buf);
+        clang_disposeCodeCompleteResults(res);
+
+        // The same qualifier can be completed as a different kind, e.g. as a type instead of an expression
+        if (shared && shared->contexts != contexts) {
+                shared.reset();
+                mShared.remove(pos.key);
+        }
+
+        shared_completions entry{nullptr, {}, contexts, now};
+        if (!shared) {
+                // Only the preamble can tell which results come from the headers, complete it without the file
+                std::vector<CXUnsavedFile> headers = unsaved;
+                auto it = std::find_if(headers.begin(), headers.end(), [&file](const CXUnsavedFile& f) {
+                        return file == f.Filename;
+                });
+
+                if (it == headers.end())
+                        it = headers.insert(headers.end(), CXUnsavedFile());
 
-                for (unsigned i = 0; i < res.numEntries; ++i ) {
-                        CXTUResourceUsageEntry entry = res.entries[i];
-                        if (entry.kind <= 14)
-                                all += entry.amount;
+                it->Filename = file.c_str();
+                it->Contents = pos.source.data();
+                it->Length = pos.source.size();
+
+                {
+                        trace_scope span(mTracer, "codeCompleteShared", file);
+                        res = clang_codeCompleteAt(unit, file.c_str(), pos.row, pos.col, headers.data(), headers.size(),
+                                CXCodeComplete_IncludeMacros);
                 }
 
-                v8::Local<v8::Array> entry = Nan::New<v8::Array>();
-                entry->Set(0, Nan::New(e.first.c_str()).ToLocalChecked());
-                entry->Set(1, Nan::New(all));
-                ret->Set(j++, entry);
+                if (!res)
+                        return false;
 
-                clang_disposeCXTUResourceUsage(res);
-        }
+                // A position the synthetic file doesn't reproduce is completed in full
+                if (clang_codeCompleteGetContexts(res) != contexts) {
+                        clang_disposeCodeCompleteResults(res);
+                        return false;
+                }
 
-        info.GetReturnValue().Set(ret);
-}
+                entry.completions.reset(new completion_buffer());
+                {
+                        trace_scope span(mTracer, "decode", file);
+                        decode(res, *entry.completions);
+                }
 
-NAN_METHOD(autocomplete::ClearCache) {
-        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+                clang_disposeCodeCompleteResults(res);
+        }
 
-        if (info.Length() == 1) {
-                if (!info[0]->IsString()) {
-                        Nan::ThrowSyntaxError("First argument must be a String or undefined");
-                        return;
+        std::unordered_set<std::string> local;
+        for (const completion& c : buf.results)
+                local.insert(completionKey(buf, c));
+
+        {
+                trace_scope span(mTracer, "mergeShared", file);
+                const completion_buffer& from = shared ? *shared->completions : *entry.completions;
+                for (const completion& c : from.results) {
+                        if (!local.count(completionKey(from, c)))
+                                buf.append(from, c);
                 }
+        }
 
-                v8::String::Utf8Value file(info[0]);
-                instance->mCache.remove(std::string(*file, file.length()));
-        } else {
-                instance->mCache.clear();
+        if (shared)
+                return true;
+
+        // Open documents change without touching the disk, results including them aren't shared
+        clang_getInclusions(unit, collectInclusions, &entry.files);
+        for (auto& f : entry.files) {
+                if (mDocuments.count(f.first))
+                        return true;
         }
 
-        info.GetReturnValue().Set(Nan::Undefined());
+        if (!entry.completions->results.empty())
+                mShared.insert(uint64_t(pos.key), std::move(entry));
+
+        return true;
+#else
+        return false;
+#endif
+}
+
+/** Checks if col of line is inside the path of an include directive, returns the typed path and delimiter */
+static bool includePrefix(const std::string& line, uint32_t col, std::string& prefix, bool& quoted) {
+        std::size_t i = line.find_first_not_of(" \t");
+        if (i == std::string::npos || line[i] != '#')
+                return false;
+
+        i = line.find_first_not_of(" \t", i + 1);
+        std::size_t end = line.find_first_not_of("abcdefghijklmnopqrstuvwxyz_", i);
+        if (i == std::string::npos || end == std::string::npos)
+                return false;
+
+        std::string directive = line.substr(i, end - i);
+        if (directive != "include" && directive != "include_next" && directive != "import")
+                return false;
+
+        i = line.find_first_not_of(" \t", end);
+        if (i == std::string::npos || (line[i] != '<' && line[i] != '"'))
+                return false;
+
+        // columns are 1-based, the cursor has to be behind the opening delimiter
+        quoted = line[i] == '"';
+        std::size_t cursor = col - 1;
+        if (col == 0 || cursor <= i || cursor > line.size())
+                return false;
+
+        prefix = line.substr(i + 1, cursor - i - 1);
+        return prefix.find(quoted ? '"' : '>') == std::string::npos;
+}
+
+std::string autocomplete::documentLine(const std::string& file, uint32_t row) {
+        auto doc = mDocuments.find(file);
+        if (doc == mDocuments.end() || !row)
+                return std::string();
+
+        return doc->second.line(row - 1);
+}
+
+void autocomplete::completeInclude(const std::string& file, const std::string& prefix, bool quoted, completion_buffer& buf) {
+        buf.clear();
+
+        // split the typed path into the directory to list and the start of the name
+        std::size_t slash = prefix.rfind('/');
+        std::string directory = slash == std::string::npos ? "" : prefix.substr(0, slash);
+        std::string name = slash == std::string::npos ? prefix : prefix.substr(slash + 1);
+
+        std::string local;
+        if (quoted) {
+                std::size_t fileSlash = file.rfind('/');
+                local = fileSlash == std::string::npos ? "." : file.substr(0, fileSlash);
+        }
+
+        for (auto& e : mIncludes.complete(local, directory)) {
+                if (e.second.name.compare(0, name.size(), name) != 0)
+                        continue;
+
+                completion c = {e.second.directory ? "include_directory" : "include", {0, 0}, {0, 0}, {0, 0},
+                        static_cast<uint32_t>(buf.params.size()), 0, static_cast<uint32_t>(buf.qualifiers.size()), 0};
+                c.name = buf.append(e.second.name.c_str(), e.second.name.size());
+                c.description = buf.append(e.first.c_str(), e.first.size());
+                buf.results.push_back(c);
+        }
+}
+
+NAN_METHOD(autocomplete::Complete) {
+        // Check if the fuction is called correctly
+        if (info.Length() != 3) {
+                Nan::ThrowSyntaxError("Usage: filename, row, column");
+                return;
+        }
+
+        if (!info[0]->IsString()) {
+                Nan::ThrowSyntaxError("First argument must be a String");
+                return;
+        }
+
+        if (!info[1]->IsUint32()) {
+                Nan::ThrowSyntaxError("Second argument must be an Integer");
+                return;
+        }
+
+        if (!info[2]->IsUint32()) {
+                Nan::ThrowSyntaxError("Third argument must be an Integer");
+                return;
+        }
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+
+        v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+
+        v8::String::Utf8Value file(info[0]);
+        uint32_t row = info[1]->ToUint32()->Value();
+        uint32_t col = info[2]->ToUint32()->Value();
+
+        std::string sFile(*file, file.length());
+        trace_scope span(instance->mTracer, "complete", sFile);
+
+        completion_buffer& buf = instance->mCompletions;
+        std::string prefix;
+        bool quoted;
+
+        // #include paths are answered from the directory index without asking clang, unless the index
+        // doesn't know the system directories searched for angled includes
+        if (includePrefix(instance->documentLine(sFile, row), col, prefix, quoted) &&
+                (quoted || instance->mIncludes.has_system_paths()))
+        {
+                trace_scope span(instance->mTracer, "includes", sFile);
+                instance->completeInclude(sFile, prefix, quoted, buf);
+        } else if (!instance->completeCode(sFile, row, col, buf)) {
+                return;
+        }
+
+        trace_scope marshalSpan(instance->mTracer, "marshal", sFile);
+
+        // Property names are shared by all results
+        v8::Local<v8::String> kName = Nan::New("name").ToLocalChecked();
+        v8::Local<v8::String> kType = Nan::New("type").ToLocalChecked();
+        v8::Local<v8::String> kReturn = Nan::New("return").ToLocalChecked();
+        v8::Local<v8::String> kDescription = Nan::New("description").ToLocalChecked();
+        v8::Local<v8::String> kParams = Nan::New("params").ToLocalChecked();
+        v8::Local<v8::String> kQualifiers = Nan::New("qualifiers").ToLocalChecked();
+
+        auto str = [&buf](string_ref ref) -> v8::Local<v8::String> {
+                return Nan::New(buf.data(ref), ref.length).ToLocalChecked();
+        };
+
+        for (uint32_t j = 0; j < buf.results.size(); ++j) {
+                const completion& c = buf.results[j];
+
+                v8::Local<v8::Array> rArgs = Nan::New<v8::Array>(c.num_params);
+                for (uint32_t k = 0; k < c.num_params; ++k)
+                        rArgs->Set(k, str(buf.params[c.first_param + k]));
+
+                v8::Local<v8::Array> rQualifiers = Nan::New<v8::Array>(c.num_qualifiers);
+                for (uint32_t k = 0; k < c.num_qualifiers; ++k)
+                        rQualifiers->Set(k, str(buf.qualifiers[c.first_qualifier + k]));
+
+                v8::Local<v8::Object> rObj = Nan::New<v8::Object>();
+                rObj->Set(kName, str(c.name));
+                rObj->Set(kType, Nan::New(c.type).ToLocalChecked());
+                rObj->Set(kReturn, str(c.result));
+                rObj->Set(kDescription, str(c.description));
+                rObj->Set(kParams, rArgs);
+                rObj->Set(kQualifiers, rQualifiers);
+
+                ret->Set(j, rObj);
+        }
+
+        info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(autocomplete::Diagnose) {
+        // Check if the fuction is called correctly
+        if (info.Length() != 1) {
+                Nan::ThrowSyntaxError("Usage: filename");
+                return;
+        }
+
+        if (!info[0]->IsString()) {
+                Nan::ThrowSyntaxError("First argument must be an String");
+                return;
+        }
+
+        // Create the local scope and get the instance
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+
+        // Convert string vector to a const char* vector for clang_parseTranslationUnit
+        std::vector<const char*> cArgs;
+        std::transform( instance->mArgs.begin(), instance->mArgs.end(), std::back_inserter(cArgs),
+                        [](const std::string &s) -> const char* {
+                        return s.c_str();
+                }
+                        );
+
+        v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+        v8::String::Utf8Value file(info[0]);
+
+        std::string sFile(*file, file.length());
+        trace_scope span(instance->mTracer, "diagnose", sFile);
+
+        // Don't cache diagnostics
+        unsigned options = CXTranslationUnit_PrecompiledPreamble | clang_defaultDiagnosticDisplayOptions();
+        CXTranslationUnit trans;
+        {
+                trace_scope parseSpan(instance->mTracer, "parse", sFile);
+                std::vector<CXUnsavedFile> unsaved = instance->unsavedFiles();
+                trans = clang_parseTranslationUnit(instance->mIndex, *file, &cArgs[0], cArgs.size(), unsaved.data(), unsaved.size(), options);
+        }
+
+        if (!trans) {
+                Nan::ThrowError("Unable to build translation unit");
+                return;
+        }
+
+        int dOpt = 0;
+
+        // iterate through diagnostics
+        uint32_t j = 0;
+        for (uint32_t i = 0; i < clang_getNumDiagnostics(trans); ++i) {
+                CXDiagnostic d = clang_getDiagnostic(trans, i);
+
+                // get diagnostic warning
+                CXString str = clang_formatDiagnostic(d, dOpt);
+
+                // get diagnostic location
+                CXString file;
+                unsigned line;
+                unsigned col;
+                CXSourceLocation loc = clang_getDiagnosticLocation(d);
+                clang_getPresumedLocation(loc, &file, &line, &col);
+
+                // propagate to node
+                v8::Local<v8::Array> diagnostics = Nan::New<v8::Array>();
+                diagnostics->Set(0, Nan::New(clang_getCString(file)).ToLocalChecked());
+                diagnostics->Set(1, Nan::New(line));
+                diagnostics->Set(2, Nan::New(col));
+                diagnostics->Set(3, Nan::New(clang_getCString(str)).ToLocalChecked());
+                diagnostics->Set(4, Nan::New(clang_getDiagnosticSeverity(d)));
+
+                ret->Set(j++, diagnostics);
+
+                clang_disposeString(file);
+                clang_disposeString(str);
+                clang_disposeDiagnostic(d);
+        }
+
+        {
+                trace_scope disposeSpan(instance->mTracer, "dispose", sFile);
+                clang_disposeTranslationUnit(trans);
+        }
+
+        info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(autocomplete::MemoryUsage) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+
+        v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+        uint32_t j = 0;
+
+        instance->mCache.for_each([&](const std::string& file, const cached_unit& cached) {
+                v8::Local<v8::Array> entry = Nan::New<v8::Array>();
+                entry->Set(0, Nan::New(file.c_str()).ToLocalChecked());
+                entry->Set(1, Nan::New(static_cast<uint32_t>(memoryUsage(cached.unit))));
+                entry->Set(2, Nan::New(cached.tier == parse_tier::full ? "full" : "background").ToLocalChecked());
+                ret->Set(j++, entry);
+        });
+
+        info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(autocomplete::ClearCache) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+
+        if (info.Length() == 1) {
+                if (!info[0]->IsString()) {
+                        Nan::ThrowSyntaxError("First argument must be a String or undefined");
+                        return;
+                }
+
+                v8::String::Utf8Value file(info[0]);
+                instance->mCache.remove(std::string(*file, file.length()));
+        } else {
+                instance->mCache.clear();
+                instance->mShared.clear();
+        }
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(autocomplete::Prefetch) {
+        if (info.Length() != 1 || !info[0]->IsString()) {
+                Nan::ThrowSyntaxError("Usage: filename");
+                return;
+        }
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+        std::string sFile(*file, file.length());
+
+        if (!instance->mCache.has(sFile) && !instance->translationUnit(sFile, parse_tier::background)) {
+                Nan::ThrowError("Unable to build translation unit");
+                return;
+        }
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(autocomplete::WriteTrace) {
+        if (info.Length() != 1 || !info[0]->IsString()) {
+                Nan::ThrowSyntaxError("Usage: filename");
+                return;
+        }
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+
+        if (!instance->mTracer.write(std::string(*file, file.length()))) {
+                Nan::ThrowError("Unable to write trace file");
+                return;
+        }
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(autocomplete::Subscribe) {
+        if (info.Length() != 1 || !info[0]->IsFunction()) {
+                Nan::ThrowSyntaxError("Usage: callback(filename, added, removed)");
+                return;
+        }
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        instance->mDiagnosticsCb.reset(new Nan::Callback(info[0].As<v8::Function>()));
+        instance->mDiagnosticsResource.reset(new Nan::AsyncResource("clang_autocomplete:diagnostics"));
+
+        // A new subscriber starts without any known diagnostics, a scheduled delivery still releases its reference
+        instance->mDiagnostics.clear();
+        instance->mPendingDiagnostics.clear();
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(autocomplete::Unsubscribe) {
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        instance->mDiagnosticsCb.reset();
+        instance->mDiagnosticsResource.reset();
+        instance->mDiagnostics.clear();
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+unit_cache::handle autocomplete::translationUnit(const std::string& file, parse_tier tier) {
+        unit_cache::handle cached = mCache.get(file);
+        std::vector<CXUnsavedFile> unsaved = unsavedFiles();
+
+        // Remember which state of an open document is being parsed
+        uint64_t version = 0;
+        uint64_t preamble = 0;
+        auto doc = mDocuments.find(file);
+        if (doc != mDocuments.end()) {
+                version = doc->second.version();
+                preamble = doc->second.preamble_revision();
+        }
+
+        if (cached) {
+                if (cached->tier >= tier) {
+                        cached->parsed = time(NULL);
+                        cached->version = version;
+                        cached->preamble = preamble;
+
+                        // reparsing saves a moderate amount of time
+                        {
+                                trace_scope span(mTracer, "reparse", file);
+                                clang_reparseTranslationUnit(cached->unit, unsaved.size(), unsaved.data(), 0);
+                        }
+
+                        cached->precompiled = true;
+
+                        // The unit may have grown past the limit, it is pinned and only evicts others
+                        if (mPolicy == cache_policy::memory) {
+                                cached.set_weight(memoryUsage(cached->unit));
+                                mCache.purge();
+                        }
+
+                        if (cached->tier == parse_tier::full)
+                                publishDiagnostics(file, cached->unit);
+
+                        return cached;
+                }
+
+                // Reparsing keeps the original options, upgrading needs a fresh unit
+                cached.reset();
+                mCache.remove(file);
+        }
+
+        // Convert string vector to a const char* vector for clang_parseTranslationUnit
+        std::vector<const char*> cArgs;
+        std::transform( mArgs.begin(), mArgs.end(), std::back_inserter(cArgs),
+                        [](const std::string &s) -> const char* {
+                        return s.c_str();
+                }
+                        );
+
+        // The completion options, background units only need declarations
+        unsigned options = CXTranslationUnit_PrecompiledPreamble | CXTranslationUnit_CacheCompletionResults;
+        if (tier == parse_tier::background)
+                options = CXTranslationUnit_SkipFunctionBodies;
+
+        CXTranslationUnit trans;
+        time_t parsed = time(NULL);
+        {
+                trace_scope span(mTracer, tier == parse_tier::full ? "parse" : "parseBackground", file);
+                if (CXErrorCode err = clang_parseTranslationUnit2(mIndex, file.c_str(), cArgs.data(), cArgs.size(), unsaved.data(), unsaved.size(), options, &trans)) {
+                        // TODO: process error
+                        return unit_cache::handle();
+                }
+        }
+
+        // If another request cached the file in the meantime, its unit is kept and ours is disposed
+        cached = mCache.insert(std::string(file), cached_unit{trans, tier, parsed, version, preamble, false});
+        if (mPolicy == cache_policy::memory) {
+                cached.set_weight(memoryUsage(cached->unit));
+                mCache.purge();
+        }
+
+        // Diagnostics of skipped function bodies are missing, only publish complete sets
+        if (cached->tier == parse_tier::full)
+                publishDiagnostics(file, cached->unit);
+
+        return cached;
+}
+
+/** Converts a source range to a JS object */
+static v8::Local<v8::Object> rangeToObject(const source_range& range) {
+        v8::Local<v8::Object> start = Nan::New<v8::Object>();
+        start->Set(Nan::New("line").ToLocalChecked(), Nan::New(range.start_line));
+        start->Set(Nan::New("column").ToLocalChecked(), Nan::New(range.start_column));
+
+        v8::Local<v8::Object> end = Nan::New<v8::Object>();
+        end->Set(Nan::New("line").ToLocalChecked(), Nan::New(range.end_line));
+        end->Set(Nan::New("column").ToLocalChecked(), Nan::New(range.end_column));
+
+        v8::Local<v8::Object> ret = Nan::New<v8::Object>();
+        ret->Set(Nan::New("file").ToLocalChecked(), Nan::New(range.file.c_str()).ToLocalChecked());
+        ret->Set(Nan::New("start").ToLocalChecked(), start);
+        ret->Set(Nan::New("end").ToLocalChecked(), end);
+        return ret;
+}
+
+/** Converts a list of diagnostics to a JS array */
+static v8::Local<v8::Array> diagnosticsToArray(const std::vector<diagnostic>& diags) {
+        v8::Local<v8::Array> ret = Nan::New<v8::Array>(diags.size());
+
+        for (uint32_t i = 0; i < diags.size(); ++i) {
+                const diagnostic& d = diags[i];
+
+                v8::Local<v8::Array> rRanges = Nan::New<v8::Array>(d.ranges.size());
+                for (uint32_t j = 0; j < d.ranges.size(); ++j)
+                        rRanges->Set(j, rangeToObject(d.ranges[j]));
+
+                v8::Local<v8::Array> rFixits = Nan::New<v8::Array>(d.fixits.size());
+                for (uint32_t j = 0; j < d.fixits.size(); ++j) {
+                        v8::Local<v8::Object> rFixit = Nan::New<v8::Object>();
+                        rFixit->Set(Nan::New("range").ToLocalChecked(), rangeToObject(d.fixits[j].range));
+                        rFixit->Set(Nan::New("text").ToLocalChecked(), Nan::New(d.fixits[j].text.c_str()).ToLocalChecked());
+                        rFixits->Set(j, rFixit);
+                }
+
+                v8::Local<v8::Object> rObj = Nan::New<v8::Object>();
+                rObj->Set(Nan::New("file").ToLocalChecked(), Nan::New(d.file.c_str()).ToLocalChecked());
+                rObj->Set(Nan::New("line").ToLocalChecked(), Nan::New(d.line));
+                rObj->Set(Nan::New("column").ToLocalChecked(), Nan::New(d.column));
+                rObj->Set(Nan::New("severity").ToLocalChecked(), Nan::New(d.severity));
+                rObj->Set(Nan::New("message").ToLocalChecked(), Nan::New(d.message.c_str()).ToLocalChecked());
+                rObj->Set(Nan::New("category").ToLocalChecked(), Nan::New(d.category.c_str()).ToLocalChecked());
+                rObj->Set(Nan::New("ranges").ToLocalChecked(), rRanges);
+                rObj->Set(Nan::New("fixits").ToLocalChecked(), rFixits);
+
+                ret->Set(i, rObj);
+        }
+
+        return ret;
+}
+
+void autocomplete::publishDiagnostics(const std::string& file, CXTranslationUnit trans) {
+        if (!mDiagnosticsCb)
+                return;
+
+        trace_scope span(mTracer, "diagnostics", file);
+
+        std::vector<diagnostic> current = collect_diagnostics(trans);
+        std::vector<diagnostic>& previous = mDiagnostics[file];
+
+        std::vector<const diagnostic*> added;
+        std::vector<const diagnostic*> removed;
+        diff_diagnostics(previous, current, added, removed);
+
+        if (!added.empty() || !removed.empty()) {
+                diagnostics_delta delta = {file, {}, {}};
+                for (const diagnostic* d : added)
+                        delta.added.push_back(*d);
+
+                for (const diagnostic* d : removed)
+                        delta.removed.push_back(*d);
+
+                queueDiagnostics(std::move(delta));
+        }
+
+        previous.swap(current);
+}
+
+void autocomplete::retractDiagnostics(const std::string& file) {
+        auto published = mDiagnostics.find(file);
+        if (published == mDiagnostics.end())
+                return;
+
+        // The subscriber would otherwise receive them as added again once the file is parsed
+        if (mDiagnosticsCb && !published->second.empty())
+                queueDiagnostics(diagnostics_delta{file, {}, std::move(published->second)});
+
+        mDiagnostics.erase(published);
+}
+
+void autocomplete::queueDiagnostics(diagnostics_delta&& delta) {
+        // Keep this object alive until the deltas are delivered
+        if (!mDeliveryScheduled) {
+                mDeliveryScheduled = true;
+                Ref();
+                uv_async_send(mNotify);
+        }
+
+        mPendingDiagnostics.push_back(std::move(delta));
+}
+
+NAUV_WORK_CB(autocomplete::DeliverDiagnostics) {
+        autocomplete* instance = static_cast<autocomplete*>(async->data);
+        if (!instance || !instance->mDeliveryScheduled)
+                return;
+
+        Nan::HandleScope scope;
+
+        // The subscriber may call back into us and queue new deltas, which schedules another delivery
+        std::vector<diagnostics_delta> pending;
+        pending.swap(instance->mPendingDiagnostics);
+        instance->mDeliveryScheduled = false;
+
+        for (const diagnostics_delta& delta : pending) {
+                if (!instance->mDiagnosticsCb)
+                        break;
+
+                v8::Local<v8::Value> argv[] = {
+                        Nan::New(delta.file.c_str()).ToLocalChecked(),
+                        diagnosticsToArray(delta.added),
+                        diagnosticsToArray(delta.removed)
+                };
+
+                // Copy the callback, the subscriber may unsubscribe while being called
+                Nan::Callback cb(instance->mDiagnosticsCb->GetFunction());
+                Nan::TryCatch tryCatch;
+                cb.Call(3, argv, instance->mDiagnosticsResource.get());
+
+                if (tryCatch.HasCaught())
+                        Nan::FatalException(tryCatch);
+        }
+
+        instance->Unref();
+}
+
+unit_cache::handle autocomplete::currentUnit(const std::string& file) {
+        unit_cache::handle cached = mCache.get(file);
+
+        if (cached && cached->tier == parse_tier::full) {
+                auto doc = mDocuments.find(file);
+                if (doc != mDocuments.end()) {
+                        if (cached->version == doc->second.version())
+                                return cached;
+                } else {
+                        // Files modified during the second of the last parse are treated as changed
+                        struct stat st;
+                        if (!cached->version && stat(file.c_str(), &st) == 0 && st.st_mtime < cached->parsed)
+                                return cached;
+                }
+        }
+
+        cached.reset();
+        return translationUnit(file);
+}
+
+std::vector<CXUnsavedFile> autocomplete::unsavedFiles() {
+        std::vector<CXUnsavedFile> ret;
+        ret.reserve(mDocuments.size());
+
+        for (auto& doc : mDocuments) {
+                const std::string& text = doc.second.text();
+                ret.push_back({doc.first.c_str(), text.data(), text.size()});
+        }
+
+        return ret;
+}
+
+void autocomplete::invalidate(const std::string& file) {
+        unit_cache::handle cached = mCache.get(file);
+        if (cached) {
+                cached->parsed = 0;
+                cached->version = 0;
+                cached->preamble = 0;
+        }
+}
+
+/** Reads a {line, character} object */
+static bool toPosition(v8::Local<v8::Value> value, text_position& pos) {
+        if (!value->IsObject())
+                return false;
+
+        v8::Local<v8::Object> obj = value->ToObject();
+        v8::Local<v8::Value> line = obj->Get(Nan::New("line").ToLocalChecked());
+        v8::Local<v8::Value> character = obj->Get(Nan::New("character").ToLocalChecked());
+
+        if (!line->IsUint32() || !character->IsUint32())
+                return false;
+
+        pos.line = line->Uint32Value();
+        pos.character = character->Uint32Value();
+        return true;
+}
+
+NAN_METHOD(autocomplete::Open) {
+        if (info.Length() != 2 || !info[0]->IsString() || !info[1]->IsString()) {
+                Nan::ThrowSyntaxError("Usage: filename, text");
+                return;
+        }
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+        v8::String::Utf8Value text(info[1]);
+        std::string sFile(*file, file.length());
+
+        instance->mDocuments.erase(sFile);
+        instance->mDocuments.emplace(sFile, document(*text, text.length()));
+        instance->invalidate(sFile);
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(autocomplete::Edit) {
+        if (info.Length() != 3 || !info[0]->IsString() || !info[1]->IsObject() || !info[2]->IsString()) {
+                Nan::ThrowSyntaxError("Usage: filename, {start: {line, character}, end: {line, character}}, text");
+                return;
+        }
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+        v8::String::Utf8Value text(info[2]);
+
+        auto doc = instance->mDocuments.find(std::string(*file, file.length()));
+        if (doc == instance->mDocuments.end()) {
+                Nan::ThrowError("Document is not open");
+                return;
+        }
+
+        v8::Local<v8::Object> range = info[1]->ToObject();
+        text_position start, end;
+        if (!toPosition(range->Get(Nan::New("start").ToLocalChecked()), start) ||
+            !toPosition(range->Get(Nan::New("end").ToLocalChecked()), end)) {
+                Nan::ThrowSyntaxError("Range must be {start: {line, character}, end: {line, character}}");
+                return;
+        }
+
+        if (!doc->second.edit(start, end, *text, text.length())) {
+                Nan::ThrowRangeError("Range is outside of the document");
+                return;
+        }
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+NAN_METHOD(autocomplete::Close) {
+        if (info.Length() != 1 || !info[0]->IsString()) {
+                Nan::ThrowSyntaxError("Usage: filename");
+                return;
+        }
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+        std::string sFile(*file, file.length());
+
+        instance->mDocuments.erase(sFile);
+        instance->invalidate(sFile);
+
+        info.GetReturnValue().Set(Nan::Undefined());
+}
+
+/** Validates the [filename|row|col] arguments of a cursor query */
+static bool checkPosition(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        if (info.Length() != 3) {
+                Nan::ThrowSyntaxError("Usage: filename, row, column");
+                return false;
+        }
+
+        if (!info[0]->IsString()) {
+                Nan::ThrowSyntaxError("First argument must be a String");
+                return false;
+        }
+
+        if (!info[1]->IsUint32() || !info[2]->IsUint32()) {
+                Nan::ThrowSyntaxError("Second and third argument must be Integers");
+                return false;
+        }
+
+        return true;
+}
+
+/** Returns the cursor at a position of a translation unit */
+static CXCursor cursorAt(CXTranslationUnit unit, const std::string& file, uint32_t row, uint32_t col) {
+        CXFile cFile = clang_getFile(unit, file.c_str());
+        if (!cFile)
+                return clang_getNullCursor();
+
+        return clang_getCursor(unit, clang_getLocation(unit, cFile, row, col));
+}
+
+/** Returns the declaration referenced by a cursor or the cursor itself if it is one */
+static CXCursor referencedCursor(CXCursor cursor) {
+        CXCursor ref = clang_getCursorReferenced(cursor);
+        return clang_Cursor_isNull(ref) ? cursor : ref;
+}
+
+/** Converts a source location to a JS object */
+static v8::Local<v8::Object> locationToObject(CXSourceLocation loc) {
+        CXString file;
+        unsigned line, col;
+        clang_getPresumedLocation(loc, &file, &line, &col);
+
+        v8::Local<v8::Object> ret = Nan::New<v8::Object>();
+        ret->Set(Nan::New("file").ToLocalChecked(), Nan::New(detail::to_string(file).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("line").ToLocalChecked(), Nan::New(line));
+        ret->Set(Nan::New("column").ToLocalChecked(), Nan::New(col));
+        return ret;
+}
+
+/** Returns the spelling of a type, empty if it is invalid */
+static std::string typeSpelling(CXType type) {
+        if (type.kind == CXType_Invalid)
+                return "";
+
+        return detail::to_string(clang_getTypeSpelling(type));
+}
+
+NAN_METHOD(autocomplete::Definition) {
+        if (!checkPosition(info))
+                return;
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+        std::string sFile(*file, file.length());
+        trace_scope span(instance->mTracer, "definition", sFile);
+
+        unit_cache::handle trans = instance->currentUnit(sFile);
+        if (!trans) {
+                Nan::ThrowError("Unable to build translation unit");
+                return;
+        }
+
+        CXCursor cursor = cursorAt(trans->unit, sFile, info[1]->Uint32Value(), info[2]->Uint32Value());
+
+        // Fall back to the declaration if the definition isn't part of this translation unit
+        CXCursor def = clang_getCursorDefinition(cursor);
+        if (clang_Cursor_isNull(def))
+                def = clang_getCursorReferenced(cursor);
+
+        if (clang_Cursor_isNull(def) || clang_isInvalid(clang_getCursorKind(def))) {
+                info.GetReturnValue().Set(Nan::Undefined());
+                return;
+        }
+
+        info.GetReturnValue().Set(locationToObject(clang_getCursorLocation(def)));
+}
+
+NAN_METHOD(autocomplete::TypeAt) {
+        if (!checkPosition(info))
+                return;
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+        std::string sFile(*file, file.length());
+        trace_scope span(instance->mTracer, "typeAt", sFile);
+
+        unit_cache::handle trans = instance->currentUnit(sFile);
+        if (!trans) {
+                Nan::ThrowError("Unable to build translation unit");
+                return;
+        }
+
+        CXCursor cursor = cursorAt(trans->unit, sFile, info[1]->Uint32Value(), info[2]->Uint32Value());
+        CXType type = clang_getCursorType(cursor);
+
+        if (type.kind == CXType_Invalid) {
+                info.GetReturnValue().Set(Nan::Undefined());
+                return;
+        }
+
+        v8::Local<v8::Object> ret = Nan::New<v8::Object>();
+        ret->Set(Nan::New("type").ToLocalChecked(), Nan::New(typeSpelling(type).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("canonical").ToLocalChecked(), Nan::New(typeSpelling(clang_getCanonicalType(type)).c_str()).ToLocalChecked());
+        info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(autocomplete::Hover) {
+        if (!checkPosition(info))
+                return;
+
+        autocomplete* instance = Nan::ObjectWrap::Unwrap<autocomplete>(info.This());
+        v8::String::Utf8Value file(info[0]);
+        std::string sFile(*file, file.length());
+        trace_scope span(instance->mTracer, "hover", sFile);
+
+        unit_cache::handle trans = instance->currentUnit(sFile);
+        if (!trans) {
+                Nan::ThrowError("Unable to build translation unit");
+                return;
+        }
+
+        CXCursor cursor = cursorAt(trans->unit, sFile, info[1]->Uint32Value(), info[2]->Uint32Value());
+        CXCursor decl = referencedCursor(cursor);
+        CXCursorKind kind = clang_getCursorKind(decl);
+
+        if (clang_Cursor_isNull(decl) || clang_isInvalid(kind)) {
+                info.GetReturnValue().Set(Nan::Undefined());
+                return;
+        }
+
+        v8::Local<v8::Object> ret = Nan::New<v8::Object>();
+        ret->Set(Nan::New("name").ToLocalChecked(), Nan::New(detail::to_string(clang_getCursorDisplayName(decl)).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("kind").ToLocalChecked(), Nan::New(detail::to_string(clang_getCursorKindSpelling(kind)).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("type").ToLocalChecked(), Nan::New(typeSpelling(clang_getCursorType(decl)).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("return").ToLocalChecked(), Nan::New(typeSpelling(clang_getCursorResultType(decl)).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("comment").ToLocalChecked(), Nan::New(detail::to_string(clang_Cursor_getBriefCommentText(decl)).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("usr").ToLocalChecked(), Nan::New(detail::to_string(clang_getCursorUSR(decl)).c_str()).ToLocalChecked());
+        ret->Set(Nan::New("declaration").ToLocalChecked(), locationToObject(clang_getCursorLocation(decl)));
+        info.GetReturnValue().Set(ret);
+}
+
+void autocomplete::applyPolicy() {
+        std::unique_ptr<eviction_policy> policy;
+        std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+
+        switch (mPolicy) {
+        case cache_policy::lru:
+                policy.reset(new lru_policy(mLimit ? mLimit : unlimited));
+                break;
+        case cache_policy::memory:
+                policy.reset(new weight_policy(mLimit ? static_cast<std::size_t>(mLimit) << 20 : unlimited));
+                break;
+        default:
+                policy.reset(new idle_policy(mExpiration*60));
+                break;
+        }
+
+        mCache.set_policy(std::move(policy));
+
+        // Only the memory policy needs sizes, weighing a unit is too expensive to do it on every reparse
+        bool weighed = mPolicy == cache_policy::memory;
+        mCache.reweigh([this, weighed](const std::string&, const cached_unit& cached) {
+                return weighed ? memoryUsage(cached.unit) : 0;
+        });
+
+        mCache.purge();
+}
+
+std::size_t autocomplete::memoryUsage(CXTranslationUnit unit) {
+        CXTUResourceUsage res = clang_getCXTUResourceUsage(unit);
+        std::size_t all = 0;
+
+        for (unsigned i = 0; i < res.numEntries; ++i ) {
+                CXTUResourceUsageEntry entry = res.entries[i];
+                if (entry.kind <= 14)
+                        all += entry.amount;
+        }
+
+        clang_disposeCXTUResourceUsage(res);
+        return all;
 }
 
 const char* autocomplete::returnType(CXCursorKind ck) {
@@ -23,15 +23,98 @@
 #ifndef _CLANG_AUTOCOMPLETE_AUTOCOMPLETE_HPP_
 #define _CLANG_AUTOCOMPLETE_AUTOCOMPLETE_HPP_
 
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <nan.h>
 
 #include <clang-c/Index.h>
-#include "dated_map.hpp"
+#include "completion_buffer.hpp"
+#include "concurrent_cache.hpp"
+#include "diagnostics.hpp"
+#include "document.hpp"
+#include "include_index.hpp"
+#include "trace.hpp"
 
 namespace clang_autocomplete {
+    /** Fidelity a translation unit has been parsed with, ordered from cheapest to complete */
+    enum class parse_tier {
+        /** Function bodies skipped, no precompiled preamble or completion cache */
+        background,
+        /** Everything required for completion and diagnostics */
+        full
+    };
+
+    /** Eviction strategy of the translation unit cache */
+    enum class cache_policy {
+        /** Purge units unused for cache_expiration minutes */
+        idle,
+        /** Keep the cache_limit most recently used units */
+        lru,
+        /** Keep recently used units up to cache_limit megabytes */
+        memory
+    };
+
+    /** A translation unit together with the fidelity it was parsed at */
+    struct cached_unit {
+        /** Translation unit */
+        CXTranslationUnit unit;
+        /** Parse fidelity */
+        parse_tier tier;
+        /** Time the last parse or reparse started */
+        time_t parsed;
+        /** Document version parsed, 0 if the file was read from disk */
+        uint64_t version;
+        /** Document preamble revision parsed, 0 if the file was read from disk */
+        uint64_t preamble;
+        /** Whether the unit has been reparsed, libclang only precompiles the preamble then */
+        bool precompiled;
+    };
+
+    /** Cache of translation units by filename */
+    typedef concurrent_cache<std::string, cached_unit> unit_cache;
+
+    /** Completions contributed by the included headers, shared by all files with the same preamble */
+    struct shared_completions {
+        /** Decoded results */
+        std::unique_ptr<completion_buffer> completions;
+        /** Included files and their modification time when the results were decoded */
+        std::vector<std::pair<std::string, time_t>> files;
+        /** Completion contexts the results were decoded for */
+        unsigned long long contexts;
+        /** Time files were last checked for changes */
+        time_t checked;
+    };
+
+    /** Cache of shared completions by completion key */
+    typedef concurrent_cache<uint64_t, shared_completions> shared_cache;
+
+    /** A completion position that can share results, see autocomplete::sharedKey */
+    struct shared_position {
+        /** Key in the shared cache */
+        uint64_t key;
+        /** Names of the qualifier */
+        std::vector<std::string> names;
+        /** Main file consisting of the preamble and the qualifier only, completing it yields the shared results */
+        std::string source;
+        /** Line of the qualifier in source */
+        uint32_t row;
+        /** Column following the qualifier in source */
+        uint32_t col;
+    };
+
+    /** Diagnostics of a file that changed with a reparse, waiting to be sent to the subscriber */
+    struct diagnostics_delta {
+        /** File the diagnostics belong to */
+        std::string file;
+        /** New diagnostics */
+        std::vector<diagnostic> added;
+        /** Diagnostics that are gone */
+        std::vector<diagnostic> removed;
+    };
+
     /** Provides auto-completion functionality through clang's C interface */
     class autocomplete : public Nan::ObjectWrap {
     public:
@@ -62,6 +145,24 @@ namespace clang_autocomplete {
         //static void SetCacheExpiration(Local<String> property, Local<Value> value, const AccessorInfo& info);
         static NAN_SETTER(SetCacheExpiration);
 
+        /** Returns the name of the cache policy */
+        static NAN_GETTER(GetCachePolicy);
+
+        /** Sets the cache policy by name */
+        static NAN_SETTER(SetCachePolicy);
+
+        /** Returns the limit of the lru and memory policies */
+        static NAN_GETTER(GetCacheLimit);
+
+        /** Sets the limit of the lru and memory policies, 0 disables the limit */
+        static NAN_SETTER(SetCacheLimit);
+
+        /** Returns the number of retained trace spans, 0 if tracing is disabled */
+        static NAN_GETTER(GetTracing);
+
+        /** Sets the number of retained trace spans, use 0 to disable tracing */
+        static NAN_SETTER(SetTracing);
+
         /** Completes the code at [filename|row|col] */
         //static Handle<Value> Complete(const FunctionCallbackInfo<Value>& args);
         static NAN_METHOD(Complete);
@@ -77,13 +178,71 @@ namespace clang_autocomplete {
         /** Purges all cached translation units */
         //static Handle<Value> ClearCache(const FunctionCallbackInfo<Value>& args);
         static NAN_METHOD(ClearCache);
+
+        /** Returns the location of the definition of the symbol at [filename|row|col] */
+        static NAN_METHOD(Definition);
+
+        /** Returns the type of the expression at [filename|row|col] */
+        static NAN_METHOD(TypeAt);
+
+        /** Returns information about the symbol at [filename|row|col] */
+        static NAN_METHOD(Hover);
+
+        /** Opens [filename] with [text], the maintained buffer replaces the file on disk */
+        static NAN_METHOD(Open);
+
+        /** Replaces [range] of an open [filename] with [text] */
+        static NAN_METHOD(Edit);
+
+        /** Closes [filename], reverting to the file on disk */
+        static NAN_METHOD(Close);
+
+        /** Parses [filename] in the background at reduced fidelity if it isn't cached yet */
+        static NAN_METHOD(Prefetch);
+
+        /** Registers a callback receiving diagnostic deltas after each reparse */
+        static NAN_METHOD(Subscribe);
+
+        /** Removes the diagnostic callback */
+        static NAN_METHOD(Unsubscribe);
+
+        /** Writes recorded spans to [filename] in Chrome's trace event format */
+        static NAN_METHOD(WriteTrace);
     private:
         /** List of arguments passed to clang */
         std::vector<std::string> mArgs;
         /** Internal set of translation units. */
         CXIndex mIndex;
+        /** Span recorder, outlives the cache so disposals can be traced */
+        tracer mTracer;
         /** Cache for the translation units. */
-        dated_map<std::string, CXTranslationUnit> mCache;
+        unit_cache mCache;
+        /** Minutes before an unused translation unit is purged */
+        uint32_t mExpiration;
+        /** Eviction strategy of mCache */
+        cache_policy mPolicy;
+        /** Entries or megabytes kept by the lru and memory policies, 0 if unlimited */
+        uint32_t mLimit;
+        /** Diagnostics last published for each cached translation unit */
+        std::unordered_map<std::string, std::vector<diagnostic>> mDiagnostics;
+        /** Files opened through the document API */
+        std::unordered_map<std::string, document> mDocuments;
+        /** Namespace completions shared between translation units */
+        shared_cache mShared;
+        /** Directory listings of the include paths in mArgs */
+        include_index mIncludes;
+        /** Decoded completion results, reused between requests */
+        completion_buffer mCompletions;
+        /** Subscriber for diagnostic deltas, empty if there is none */
+        std::unique_ptr<Nan::Callback> mDiagnosticsCb;
+        /** Async context the subscriber is called in */
+        std::unique_ptr<Nan::AsyncResource> mDiagnosticsResource;
+        /** Deltas not yet sent to the subscriber */
+        std::vector<diagnostics_delta> mPendingDiagnostics;
+        /** A delivery is scheduled and holds a reference to this object */
+        bool mDeliveryScheduled;
+        /** Wakes up the event loop to send mPendingDiagnostics, closed asynchronously */
+        uv_async_t* mNotify;
 
         /** Constructor, initialized index */
         autocomplete();
@@ -95,8 +254,57 @@ namespace clang_autocomplete {
         //static Handle<Value> New(const FunctionCallbackInfo<Value>& args);
         static NAN_METHOD(New);
 
+        /** Parses or reparses the translation unit for file with at least tier, returns an empty handle on failure */
+        unit_cache::handle translationUnit(const std::string& file, parse_tier tier = parse_tier::full);
+
+        /** Returns the contents of all open documents for clang */
+        std::vector<CXUnsavedFile> unsavedFiles();
+
+        /** Forces the next request for file to reparse it */
+        void invalidate(const std::string& file);
+
+        /** Returns the full translation unit for file, only reparsing it if the file changed */
+        unit_cache::handle currentUnit(const std::string& file);
+
+        /** Queues diagnostics added or removed since the last call for the subscriber */
+        void publishDiagnostics(const std::string& file, CXTranslationUnit trans);
+
+        /** Queues the diagnostics last published for file as removed and forgets them */
+        void retractDiagnostics(const std::string& file);
+
+        /** Appends delta to mPendingDiagnostics, scheduling a delivery if none is outstanding */
+        void queueDiagnostics(diagnostics_delta&& delta);
+
+        /** Sends queued diagnostics once the current request has returned to the event loop */
+        static NAUV_WORK_CB(DeliverDiagnostics);
+
+        /** Installs mPolicy in mCache, weighing the cached units if it needs their size */
+        void applyPolicy();
+
+        /** Returns the memory used by a translation unit in bytes */
+        static std::size_t memoryUsage(CXTranslationUnit unit);
+
+        /** Completes code at [file|row|col] with clang, throws and returns false on failure */
+        bool completeCode(const std::string& file, uint32_t row, uint32_t col, completion_buffer& buf);
+
+        /** Completes from mShared if the position allows it, returns false if buf has not been filled */
+        bool completeShared(const std::string& file, cached_unit& trans, uint32_t row, uint32_t col,
+                std::vector<CXUnsavedFile>& unsaved, completion_buffer& buf);
+
+        /** Computes the mShared key for a completion following a qualifier, returns false if it can't be shared */
+        bool sharedKey(const std::string& file, const cached_unit& trans, uint32_t row, uint32_t col, shared_position& pos);
+
+        /** Completes the path of an include directive from the include index */
+        void completeInclude(const std::string& file, const std::string& prefix, bool quoted, completion_buffer& buf);
+
+        /** Returns line row (1-based) of file if it is an open document, an empty string otherwise */
+        std::string documentLine(const std::string& file, uint32_t row);
+
+        /** Decodes all reportable completion results into buf */
+        static void decode(CXCodeCompleteResults* res, completion_buffer& buf);
+
         /** Returns the type of the completion function */
-        const char* returnType(CXCursorKind ck);
+        static const char* returnType(CXCursorKind ck);
     };
 }
 
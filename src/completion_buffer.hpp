@@ -0,0 +1,213 @@
+/**
+* @file completion_buffer.hpp
+* @author Robin Dietrich <me (at) invokr (dot) org>
+* @version 1.0
+*
+* @par License
+*   clang-autocomplete
+*   Copyright 2015 Robin Dietrich
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License. *
+*/
+
+#ifndef _CLANG_AUTOCOMPLETE_COMPLETION_BUFFER_HPP_
+#define _CLANG_AUTOCOMPLETE_COMPLETION_BUFFER_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace clang_autocomplete {
+    /** Reference to a string stored in a completion_buffer */
+    struct string_ref {
+        /** Offset of the first character */
+        uint32_t offset;
+        /** Number of characters */
+        uint32_t length;
+    };
+
+    /** A single decoded completion result, strings are owned by the completion_buffer */
+    struct completion {
+        /** Kind of completion, e.g. "function", points to static storage */
+        const char* type;
+        /** Name to insert */
+        string_ref name;
+        /** Return type or type of the variable */
+        string_ref result;
+        /** Human readable description */
+        string_ref description;
+        /** Index of the first parameter in completion_buffer::params */
+        uint32_t first_param;
+        /** Number of parameters */
+        uint32_t num_params;
+        /** Index of the first qualifier in completion_buffer::qualifiers */
+        uint32_t first_qualifier;
+        /** Number of qualifiers */
+        uint32_t num_qualifiers;
+    };
+
+    /**
+     * Reusable storage for the completions of a single request.
+     *
+     * All strings are appended to one character arena and repeated ones, such as return types, are
+     * interned. clear() keeps every allocation around, so once the buffer has grown to the size of a
+     * typical request, decoding does not touch the heap anymore.
+     */
+    class completion_buffer {
+    public:
+        /** Decoded results */
+        std::vector<completion> results;
+        /** Parameters of all results */
+        std::vector<string_ref> params;
+        /** Qualifiers of all results */
+        std::vector<string_ref> qualifiers;
+
+        /** Constructor */
+        completion_buffer() : results(), params(), qualifiers(), mChars(), mSlots(64, 0), mInterned() {
+
+        }
+
+        /** Removed copy constructor */
+        completion_buffer(const completion_buffer&) = delete;
+
+        /** Removed copy assignment operator */
+        completion_buffer& operator=(const completion_buffer&) = delete;
+
+        /** Drops all content, keeping the allocated memory */
+        void clear() noexcept {
+            results.clear();
+            params.clear();
+            qualifiers.clear();
+            mChars.clear();
+            mInterned.clear();
+            std::fill(mSlots.begin(), mSlots.end(), 0);
+        }
+
+        /** Returns a pointer to the first character of str, the data is not NUL terminated */
+        const char* data(string_ref str) const noexcept {
+            return mChars.data() + str.offset;
+        }
+
+        /** Returns the current end of the arena, used with since() to build strings from several parts */
+        uint32_t mark() const noexcept {
+            return mChars.size();
+        }
+
+        /** Returns the string appended after mark */
+        string_ref since(uint32_t mark) const noexcept {
+            return {mark, static_cast<uint32_t>(mChars.size() - mark)};
+        }
+
+        /** Appends a string to the arena */
+        string_ref append(const char* str, std::size_t len) {
+            uint32_t offset = mChars.size();
+            mChars.insert(mChars.end(), str, str + len);
+            return {offset, static_cast<uint32_t>(len)};
+        }
+
+        /** Appends a NUL terminated string to the arena */
+        string_ref append(const char* str) {
+            return append(str, strlen(str));
+        }
+
+        /** Appends a copy of a string already stored in the arena */
+        string_ref append(string_ref str) {
+            uint32_t offset = mChars.size();
+            mChars.resize(offset + str.length);
+            memcpy(mChars.data() + offset, mChars.data() + str.offset, str.length);
+            return {offset, str.length};
+        }
+
+        /** Appends a copy of a result stored in another buffer */
+        void append(const completion_buffer& from, const completion& c) {
+            completion r = c;
+            r.name = append(from.data(c.name), c.name.length);
+            r.result = append(from.data(c.result), c.result.length);
+            r.description = append(from.data(c.description), c.description.length);
+
+            r.first_param = params.size();
+            for (uint32_t i = 0; i < c.num_params; ++i) {
+                const string_ref& p = from.params[c.first_param + i];
+                params.push_back(append(from.data(p), p.length));
+            }
+
+            r.first_qualifier = qualifiers.size();
+            for (uint32_t i = 0; i < c.num_qualifiers; ++i) {
+                const string_ref& q = from.qualifiers[c.first_qualifier + i];
+                qualifiers.push_back(append(from.data(q), q.length));
+            }
+
+            results.push_back(r);
+        }
+
+        /** Returns a reference to an identical string if one has been interned before, appends it otherwise */
+        string_ref intern(const char* str) {
+            std::size_t len = strlen(str);
+            std::size_t mask = mSlots.size() - 1;
+
+            for (std::size_t i = hash(str, len) & mask;; i = (i + 1) & mask) {
+                if (!mSlots[i]) {
+                    string_ref ret = append(str, len);
+                    mInterned.push_back(ret);
+                    mSlots[i] = mInterned.size();
+
+                    if (mInterned.size() * 2 > mSlots.size())
+                        grow();
+
+                    return ret;
+                }
+
+                string_ref& candidate = mInterned[mSlots[i] - 1];
+                if (candidate.length == len && memcmp(data(candidate), str, len) == 0)
+                    return candidate;
+            }
+        }
+    private:
+        /** Character arena */
+        std::vector<char> mChars;
+        /** Open addressing table of indices into mInterned plus one, 0 marks an empty slot */
+        std::vector<uint32_t> mSlots;
+        /** Interned strings */
+        std::vector<string_ref> mInterned;
+
+        /** FNV-1a */
+        static std::size_t hash(const char* str, std::size_t len) noexcept {
+            uint32_t h = 2166136261u;
+            for (std::size_t i = 0; i < len; ++i) {
+                h ^= static_cast<unsigned char>(str[i]);
+                h *= 16777619u;
+            }
+
+            return h;
+        }
+
+        /** Doubles the number of slots and reinserts all interned strings */
+        void grow() {
+            mSlots.assign(mSlots.size() * 2, 0);
+            std::size_t mask = mSlots.size() - 1;
+
+            for (uint32_t k = 0; k < mInterned.size(); ++k) {
+                std::size_t i = hash(data(mInterned[k]), mInterned[k].length) & mask;
+                while (mSlots[i])
+                    i = (i + 1) & mask;
+
+                mSlots[i] = k + 1;
+            }
+        }
+    };
+}
+
+#endif /* _CLANG_AUTOCOMPLETE_COMPLETION_BUFFER_HPP_ */
@@ -0,0 +1,555 @@
+/**
+* @file concurrent_cache.hpp
+* @author Robin Dietrich <me (at) invokr (dot) org>
+* @version 1.0
+*
+* @par License
+*   clang-autocomplete
+*   Copyright 2015 Robin Dietrich
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License. *
+*/
+
+#ifndef _CLANG_AUTOCOMPLETE_CONCURRENT_CACHE_HPP_
+#define _CLANG_AUTOCOMPLETE_CONCURRENT_CACHE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+namespace clang_autocomplete {
+    /** Eviction candidate passed to an eviction_policy */
+    struct eviction_candidate {
+        /** Position in the cache's candidate list, must be preserved */
+        std::size_t index;
+        /** Logical access time, larger is more recent */
+        uint64_t tick;
+        /** Wall clock time of the last access */
+        time_t accessed;
+        /** Weight of the entry, e.g. its size in bytes */
+        std::size_t weight;
+    };
+
+    /** Decides which unpinned entries should be evicted */
+    class eviction_policy {
+    public:
+        /** Destructor */
+        virtual ~eviction_policy() {}
+
+        /**
+         * Reduces candidates to the entries that should be evicted.
+         *
+         * count and weight are the totals of all entries in the cache, including pinned ones.
+         */
+        virtual void select(std::vector<eviction_candidate>& candidates, std::size_t count, std::size_t weight, time_t now) = 0;
+    };
+
+    /** Evicts entries that have not been accessed for a given number of seconds */
+    class idle_policy : public eviction_policy {
+    public:
+        /** Constructor, use 0 for indefinite storage */
+        explicit idle_policy(uint32_t seconds) : mSeconds(seconds) {
+
+        }
+
+        /** Returns the idle time in seconds */
+        uint32_t get_expiration() const noexcept {
+            return mSeconds;
+        }
+
+        void select(std::vector<eviction_candidate>& candidates, std::size_t, std::size_t, time_t now) override {
+            if (!mSeconds) {
+                candidates.clear();
+                return;
+            }
+
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](const eviction_candidate& c) {
+                return c.accessed >= now - static_cast<time_t>(mSeconds);
+            }), candidates.end());
+        }
+    private:
+        /** Time before an entry expires */
+        uint32_t mSeconds;
+    };
+
+    /** Evicts the least recently used entries once there are more than a given number */
+    class lru_policy : public eviction_policy {
+    public:
+        /** Constructor */
+        explicit lru_policy(std::size_t max_entries) : mMaxEntries(max_entries) {
+
+        }
+
+        void select(std::vector<eviction_candidate>& candidates, std::size_t count, std::size_t, time_t) override {
+            std::size_t excess = count > mMaxEntries ? count - mMaxEntries : 0;
+            excess = std::min(excess, candidates.size());
+
+            std::partial_sort(candidates.begin(), candidates.begin() + excess, candidates.end(),
+                [](const eviction_candidate& a, const eviction_candidate& b) { return a.tick < b.tick; });
+            candidates.resize(excess);
+        }
+    private:
+        /** Maximum number of entries */
+        std::size_t mMaxEntries;
+    };
+
+    /** Evicts the least recently used entries until the total weight is below a given limit */
+    class weight_policy : public eviction_policy {
+    public:
+        /** Constructor */
+        explicit weight_policy(std::size_t max_weight) : mMaxWeight(max_weight) {
+
+        }
+
+        void select(std::vector<eviction_candidate>& candidates, std::size_t, std::size_t weight, time_t) override {
+            std::sort(candidates.begin(), candidates.end(),
+                [](const eviction_candidate& a, const eviction_candidate& b) { return a.tick < b.tick; });
+
+            std::size_t num = 0;
+            while (weight > mMaxWeight && num < candidates.size())
+                weight -= std::min(weight, candidates[num++].weight);
+
+            candidates.resize(num);
+        }
+    private:
+        /** Maximum total weight */
+        std::size_t mMaxWeight;
+    };
+
+    /**
+     * Thread-safe key value cache with pluggable eviction.
+     *
+     * Entries are spread over independently locked shards. get() and insert() return a handle that
+     * pins the entry: pinned entries are never evicted, and a removed entry stays valid until its last
+     * handle is released, at which point it is purged. The purge callback is always invoked without
+     * holding a lock.
+     */
+    template <typename K, typename V>
+    class concurrent_cache {
+    private:
+        /** Structure for a single cache entry */
+        struct entry {
+            /** Value */
+            V value;
+            /** Time when the entry was last accessed */
+            time_t accessed;
+            /** Logical access time for LRU ordering */
+            uint64_t tick;
+            /** Weight used by size based policies */
+            std::size_t weight;
+            /** Number of handles referencing this entry */
+            uint32_t pins;
+            /** Whether the entry has been taken out of the cache while pinned */
+            bool removed;
+            /** Key of a removed entry, needed for the purge callback */
+            K key;
+        };
+
+        /** Map type of a single shard, entries outlive their removal while pinned */
+        typedef std::unordered_map<K, std::shared_ptr<entry>> container;
+
+        /** A single lock stripe */
+        struct shard {
+            /** Guards entries and the pin counts of all entries */
+            std::mutex lock;
+            /** Entries of this shard */
+            container entries;
+        };
+
+        /** An entry that has been taken out of the cache and awaits the purge callback */
+        typedef std::pair<K, V> purged;
+    public:
+        /** Type for the callback-function run on each deleted entry, must not throw */
+        typedef std::function<void(const K&, V&)> callback_type;
+
+        /** Type for the callback-function run on values rejected by insert, must not throw */
+        typedef std::function<void(V&)> reject_callback_type;
+
+        /** Pins an entry for as long as it is alive */
+        class handle {
+        public:
+            /** Creates an empty handle */
+            handle() noexcept : mCache(nullptr), mShard(nullptr), mEntry() {
+
+            }
+
+            /** Destructor, unpins the entry */
+            ~handle() {
+                reset();
+            }
+
+            /** Removed copy constructor */
+            handle(const handle&) = delete;
+
+            /** Removed copy assignment operator */
+            handle& operator=(const handle&) = delete;
+
+            /** Move constructor */
+            handle(handle&& other) noexcept : mCache(other.mCache), mShard(other.mShard), mEntry(std::move(other.mEntry)) {
+
+            }
+
+            /** Move assignment operator */
+            handle& operator=(handle&& other) noexcept {
+                if (this != &other) {
+                    reset();
+                    std::swap(mCache, other.mCache);
+                    std::swap(mShard, other.mShard);
+                    std::swap(mEntry, other.mEntry);
+                }
+
+                return *this;
+            }
+
+            /** Returns true if the handle references an entry */
+            explicit operator bool() const noexcept {
+                return mEntry != nullptr;
+            }
+
+            /** Returns the value */
+            V& operator*() const noexcept {
+                return mEntry->value;
+            }
+
+            /** Returns a pointer to the value */
+            V* operator->() const noexcept {
+                return &mEntry->value;
+            }
+
+            /** Sets the weight of the entry, e.g. its size in bytes */
+            void set_weight(std::size_t weight) {
+                std::lock_guard<std::mutex> lock(mShard->lock);
+                if (!mEntry->removed) {
+                    mCache->mWeight += weight;
+                    mCache->mWeight -= mEntry->weight;
+                }
+
+                mEntry->weight = weight;
+            }
+
+            /** Unpins the entry, the handle is empty afterwards */
+            void reset() {
+                if (!mEntry)
+                    return;
+
+                mCache->unpin(*mShard, *mEntry);
+                mEntry.reset();
+            }
+        private:
+            friend class concurrent_cache;
+
+            /** Cache the entry belongs to */
+            concurrent_cache* mCache;
+            /** Shard the entry lives in */
+            shard* mShard;
+            /** Pinned entry */
+            std::shared_ptr<entry> mEntry;
+
+            /** Constructor, the entry has to be pinned already */
+            handle(concurrent_cache* cache, shard* s, std::shared_ptr<entry> e) noexcept : mCache(cache), mShard(s), mEntry(std::move(e)) {
+
+            }
+        };
+
+        /** Constructor, entries expire after 30 minutes of inactivity by default */
+        explicit concurrent_cache(std::size_t shards = 16)
+            : mShards(shards ? shards : 1), mPolicy(new idle_policy(30*60)), mPolicyLock(), mCb(), mRejectCb(),
+              mCheckInterval(10*60), mLastCheck(time(NULL)), mTick(0), mCount(0), mWeight(0)
+        {
+
+        }
+
+        /** Destructor, calls purge function on remaining entries. */
+        ~concurrent_cache() {
+            clear();
+        }
+
+        /** Removed copy constructor */
+        concurrent_cache(const concurrent_cache&) = delete;
+
+        /** Removed copy assignment operator */
+        concurrent_cache& operator=(const concurrent_cache&) = delete;
+
+        /** Checks if an entry exists */
+        bool has(const K& key) {
+            shard& s = shard_for(key);
+            std::lock_guard<std::mutex> lock(s.lock);
+
+            return s.entries.find(key) != s.entries.end();
+        }
+
+        /** Returns a pinned handle to the entry or an empty handle if it doesn't exist */
+        handle get(const K& key) {
+            handle ret;
+            {
+                shard& s = shard_for(key);
+                std::lock_guard<std::mutex> lock(s.lock);
+
+                auto it = s.entries.find(key);
+                if (it != s.entries.end())
+                    ret = pin(s, it->second);
+            }
+
+            // check if we need to purge stuff
+            time_t now = time(NULL);
+            if (mLastCheck.load() + static_cast<time_t>(mCheckInterval.load()) < now)
+                purge();
+
+            return ret;
+        }
+
+        /**
+         * Pushes a new entry and returns it pinned.
+         *
+         * If the key already exists, the existing entry is returned and value is passed to the reject callback.
+         * The purge callback isn't invoked, as the entry stored under key stays in the cache.
+         */
+        handle insert(K&& key, V&& value) {
+            handle ret;
+            bool rejected = false;
+            {
+                shard& s = shard_for(key);
+                std::lock_guard<std::mutex> lock(s.lock);
+
+                auto it = s.entries.find(key);
+                if (it != s.entries.end()) {
+                    rejected = true;
+                } else {
+                    std::shared_ptr<entry> e(new entry{std::move(value), time(NULL), 0, 0, 0, false, K()});
+                    it = s.entries.emplace(std::move(key), std::move(e)).first;
+                    ++mCount;
+                }
+
+                ret = pin(s, it->second);
+            }
+
+            if (rejected && mRejectCb)
+                mRejectCb(value);
+
+            purge();
+            return ret;
+        }
+
+        /** Removes a single cache entry, pinned entries are removed once they are released */
+        void remove(const K& key) {
+            std::vector<purged> victims;
+            {
+                shard& s = shard_for(key);
+                std::lock_guard<std::mutex> lock(s.lock);
+
+                auto it = s.entries.find(key);
+                if (it != s.entries.end())
+                    take(s, it, victims);
+            }
+
+            invoke(victims);
+        }
+
+        /** Clears the cache, removing any entries */
+        void clear() {
+            std::vector<purged> victims;
+            for (shard& s : mShards) {
+                std::lock_guard<std::mutex> lock(s.lock);
+                for (auto it = s.entries.begin(); it != s.entries.end();)
+                    it = take(s, it, victims);
+            }
+
+            invoke(victims);
+        }
+
+        /** Calls fcn(key, value) for each entry while holding the lock of its shard */
+        template <typename F>
+        void for_each(F fcn) {
+            for (shard& s : mShards) {
+                std::lock_guard<std::mutex> lock(s.lock);
+                for (auto& e : s.entries)
+                    fcn(e.first, e.second->value);
+            }
+        }
+
+        /** Sets the weight of each entry to fcn(key, value), unlike handle::set_weight it doesn't count as an access */
+        template <typename F>
+        void reweigh(F fcn) {
+            for (shard& s : mShards) {
+                std::lock_guard<std::mutex> lock(s.lock);
+                for (auto& e : s.entries) {
+                    std::size_t weight = fcn(e.first, e.second->value);
+                    mWeight += weight;
+                    mWeight -= e.second->weight;
+                    e.second->weight = weight;
+                }
+            }
+        }
+
+        /** Evicts all entries selected by the current policy */
+        void purge() {
+            time_t now = time(NULL);
+            mLastCheck = now;
+
+            // collect all entries that could be evicted
+            std::vector<std::pair<shard*, K>> keys;
+            std::vector<eviction_candidate> candidates;
+
+            for (shard& s : mShards) {
+                std::lock_guard<std::mutex> lock(s.lock);
+                for (auto& e : s.entries) {
+                    if (e.second->pins)
+                        continue;
+
+                    candidates.push_back({keys.size(), e.second->tick, e.second->accessed, e.second->weight});
+                    keys.emplace_back(&s, e.first);
+                }
+            }
+
+            if (candidates.empty())
+                return;
+
+            {
+                std::lock_guard<std::mutex> lock(mPolicyLock);
+                mPolicy->select(candidates, mCount.load(), mWeight.load(), now);
+            }
+
+            // remove everything that hasn't been used in the meantime
+            std::vector<purged> victims;
+            for (const eviction_candidate& c : candidates) {
+                shard& s = *keys[c.index].first;
+                std::lock_guard<std::mutex> lock(s.lock);
+
+                auto it = s.entries.find(keys[c.index].second);
+                if (it != s.entries.end() && !it->second->pins && it->second->tick == c.tick)
+                    take(s, it, victims);
+            }
+
+            invoke(victims);
+        }
+
+        /** Sets the eviction policy */
+        void set_policy(std::unique_ptr<eviction_policy> policy) {
+            std::lock_guard<std::mutex> lock(mPolicyLock);
+            mPolicy = std::move(policy);
+        }
+
+        /** Sets the time in seconds between expiration checks on access */
+        void set_frequency(uint32_t check_frequency) noexcept {
+            mCheckInterval = check_frequency;
+        }
+
+        /** Returns time in seconds between expiration checks */
+        uint32_t get_frequency() const noexcept {
+            return mCheckInterval;
+        }
+
+        /** Returns the number of entries */
+        std::size_t size() const noexcept {
+            return mCount;
+        }
+
+        /** Returns the total weight of all entries */
+        std::size_t weight() const noexcept {
+            return mWeight;
+        }
+
+        /** Sets the callback function invoked on each deleted entry */
+        void set_purge_callback(callback_type fcn) {
+            mCb = std::move(fcn);
+        }
+
+        /** Sets the callback function invoked on values that were not inserted because their key exists */
+        void set_reject_callback(reject_callback_type fcn) {
+            mRejectCb = std::move(fcn);
+        }
+    private:
+        /** Lock stripes */
+        std::vector<shard> mShards;
+        /** Eviction policy */
+        std::unique_ptr<eviction_policy> mPolicy;
+        /** Guards mPolicy */
+        std::mutex mPolicyLock;
+        /** Deletion callback */
+        callback_type mCb;
+        /** Rejection callback */
+        reject_callback_type mRejectCb;
+        /** Time between expiration checks */
+        std::atomic<uint32_t> mCheckInterval;
+        /** Time of the last check */
+        std::atomic<time_t> mLastCheck;
+        /** Logical clock for access ordering */
+        std::atomic<uint64_t> mTick;
+        /** Number of entries */
+        std::atomic<std::size_t> mCount;
+        /** Sum of all weights */
+        std::atomic<std::size_t> mWeight;
+
+        /** Returns the shard responsible for key */
+        shard& shard_for(const K& key) {
+            return mShards[std::hash<K>()(key) % mShards.size()];
+        }
+
+        /** Pins an entry and bumps its access time, requires the shard lock */
+        handle pin(shard& s, const std::shared_ptr<entry>& e) {
+            ++e->pins;
+            e->accessed = time(NULL);
+            e->tick = ++mTick;
+            return handle(this, &s, e);
+        }
+
+        /** Releases a pin, purges the entry if it was the last pin of a removed entry */
+        void unpin(shard& s, entry& e) {
+            std::vector<purged> victims;
+            {
+                std::lock_guard<std::mutex> lock(s.lock);
+                if (--e.pins || !e.removed)
+                    return;
+
+                victims.emplace_back(std::move(e.key), std::move(e.value));
+            }
+
+            invoke(victims);
+        }
+
+        /** Takes an entry out of the shard, pinned ones are purged by their last handle, requires the shard lock */
+        typename container::iterator take(shard& s, typename container::iterator it, std::vector<purged>& victims) {
+            entry& e = *it->second;
+            if (e.pins) {
+                e.removed = true;
+                e.key = it->first;
+            } else {
+                victims.emplace_back(it->first, std::move(e.value));
+            }
+
+            mWeight -= e.weight;
+            --mCount;
+            return s.entries.erase(it);
+        }
+
+        /** Runs the purge callback on each victim */
+        void invoke(std::vector<purged>& victims) {
+            if (!mCb)
+                return;
+
+            for (auto& v : victims)
+                mCb(v.first, v.second);
+        }
+    };
+}
+
+#endif /* _CLANG_AUTOCOMPLETE_CONCURRENT_CACHE_HPP_ */
@@ -0,0 +1,166 @@
+/**
+* @file diagnostics.hpp
+* @author Robin Dietrich <me (at) invokr (dot) org>
+* @version 1.0
+*
+* @par License
+*   clang-autocomplete
+*   Copyright 2015 Robin Dietrich
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License. *
+*/
+
+#ifndef _CLANG_AUTOCOMPLETE_DIAGNOSTICS_HPP_
+#define _CLANG_AUTOCOMPLETE_DIAGNOSTICS_HPP_
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <cstdint>
+
+#include <clang-c/Index.h>
+
+namespace clang_autocomplete {
+    /** A source range in presumed (line directive aware) coordinates */
+    struct source_range {
+        /** File the range starts in */
+        std::string file;
+        /** First line */
+        unsigned start_line;
+        /** First column */
+        unsigned start_column;
+        /** Last line */
+        unsigned end_line;
+        /** Column one past the end */
+        unsigned end_column;
+    };
+
+    /** A replacement suggested by clang */
+    struct fixit {
+        /** Range to replace */
+        source_range range;
+        /** Replacement text, empty for removals */
+        std::string text;
+    };
+
+    /** A single, structured diagnostic */
+    struct diagnostic {
+        /** File the diagnostic points at */
+        std::string file;
+        /** Line of the diagnostic */
+        unsigned line;
+        /** Column of the diagnostic */
+        unsigned column;
+        /** CXDiagnosticSeverity */
+        unsigned severity;
+        /** Unformatted message */
+        std::string message;
+        /** Diagnostic category, e.g. "Semantic Issue" */
+        std::string category;
+        /** Highlighted ranges */
+        std::vector<source_range> ranges;
+        /** Suggested fix-its */
+        std::vector<fixit> fixits;
+    };
+
+    /** Orders diagnostics by location, severity and message which together identify a diagnostic */
+    inline bool operator<(const diagnostic& lhs, const diagnostic& rhs) {
+        return std::tie(lhs.file, lhs.line, lhs.column, lhs.severity, lhs.message)
+             < std::tie(rhs.file, rhs.line, rhs.column, rhs.severity, rhs.message);
+    }
+
+    namespace detail {
+        /** Converts and disposes a CXString */
+        inline std::string to_string(CXString str) {
+            const char* cStr = clang_getCString(str);
+            std::string ret(cStr ? cStr : "");
+            clang_disposeString(str);
+            return ret;
+        }
+
+        /** Converts a CXSourceRange */
+        inline source_range to_range(CXSourceRange range) {
+            source_range ret;
+            CXString file;
+
+            clang_getPresumedLocation(clang_getRangeStart(range), &file, &ret.start_line, &ret.start_column);
+            ret.file = to_string(file);
+
+            clang_getPresumedLocation(clang_getRangeEnd(range), &file, &ret.end_line, &ret.end_column);
+            clang_disposeString(file);
+
+            return ret;
+        }
+    }
+
+    /** Returns all diagnostics of a translation unit, sorted by their identity */
+    inline std::vector<diagnostic> collect_diagnostics(CXTranslationUnit trans) {
+        std::vector<diagnostic> ret;
+        uint32_t num = clang_getNumDiagnostics(trans);
+        ret.reserve(num);
+
+        for (uint32_t i = 0; i < num; ++i) {
+            CXDiagnostic d = clang_getDiagnostic(trans, i);
+
+            diagnostic diag;
+            CXString file;
+            clang_getPresumedLocation(clang_getDiagnosticLocation(d), &file, &diag.line, &diag.column);
+            diag.file = detail::to_string(file);
+            diag.severity = clang_getDiagnosticSeverity(d);
+            diag.message = detail::to_string(clang_getDiagnosticSpelling(d));
+            diag.category = detail::to_string(clang_getDiagnosticCategoryText(d));
+
+            uint32_t numRanges = clang_getDiagnosticNumRanges(d);
+            diag.ranges.reserve(numRanges);
+            for (uint32_t j = 0; j < numRanges; ++j)
+                diag.ranges.push_back(detail::to_range(clang_getDiagnosticRange(d, j)));
+
+            uint32_t numFixits = clang_getDiagnosticNumFixIts(d);
+            diag.fixits.reserve(numFixits);
+            for (uint32_t j = 0; j < numFixits; ++j) {
+                CXSourceRange range;
+                CXString text = clang_getDiagnosticFixIt(d, j, &range);
+                diag.fixits.push_back({detail::to_range(range), detail::to_string(text)});
+            }
+
+            ret.push_back(std::move(diag));
+            clang_disposeDiagnostic(d);
+        }
+
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+
+    /** Computes which diagnostics have been added and removed between two sorted sets */
+    inline void diff_diagnostics(const std::vector<diagnostic>& previous, const std::vector<diagnostic>& current,
+        std::vector<const diagnostic*>& added, std::vector<const diagnostic*>& removed)
+    {
+        auto p = previous.begin();
+        auto c = current.begin();
+
+        while (p != previous.end() || c != current.end()) {
+            if (p == previous.end() || (c != current.end() && *c < *p)) {
+                added.push_back(&*c++);
+            } else if (c == current.end() || *p < *c) {
+                removed.push_back(&*p++);
+            } else {
+                ++p;
+                ++c;
+            }
+        }
+    }
+}
+
+#endif /* _CLANG_AUTOCOMPLETE_DIAGNOSTICS_HPP_ */
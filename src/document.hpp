@@ -0,0 +1,339 @@
+/**
+* @file document.hpp
+* @author Robin Dietrich <me (at) invokr (dot) org>
+* @version 1.0
+*
+* @par License
+*   clang-autocomplete
+*   Copyright 2015 Robin Dietrich
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License. *
+*/
+
+#ifndef _CLANG_AUTOCOMPLETE_DOCUMENT_HPP_
+#define _CLANG_AUTOCOMPLETE_DOCUMENT_HPP_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace clang_autocomplete {
+    /** A position as used by the language server protocol: 0-based line and UTF-16 code unit */
+    struct text_position {
+        /** Line */
+        uint32_t line;
+        /** Character */
+        uint32_t character;
+    };
+
+    /**
+     * An open file edited in place.
+     *
+     * The text is stored in a gap buffer so consecutive edits at the same place don't move the rest of
+     * the file. The document also keeps track of its preamble, the leading block of preprocessor
+     * directives, comments and blank lines that clang precompiles.
+     */
+    class document {
+    public:
+        /** Constructor */
+        explicit document(const char* text, std::size_t len)
+            : mBuffer(), mGapStart(0), mGapEnd(0), mLines(), mText(), mTextValid(false), mVersion(1),
+              mPreambleEnd(0), mPreambleHash(0), mPreambleRevision(1)
+        {
+            replace(text, len);
+        }
+
+        /** Replaces the whole text */
+        void replace(const char* text, std::size_t len) {
+            mBuffer.assign(text, text + len);
+            mBuffer.resize(len + gap_size);
+            mGapStart = len;
+            mGapEnd = mBuffer.size();
+
+            rebuild_lines();
+            ++mVersion;
+            mTextValid = false;
+            update_preamble();
+        }
+
+        /** Replaces the text between start and end, returns false if the range is invalid */
+        bool edit(text_position start, text_position end, const char* text, std::size_t len) {
+            std::size_t from, to;
+            if (!offset(start, from) || !offset(end, to) || to < from)
+                return false;
+
+            // Check if the preamble could have changed before our offsets are invalidated. Any edit on the
+            // first line after it can turn that line into a directive, even behind its indentation.
+            auto next = std::upper_bound(mLines.begin(), mLines.end(), mPreambleEnd);
+            bool preamble = from <= (next != mLines.end() ? *next : size());
+
+            move_gap(from);
+            mGapEnd += to - from;
+
+            if (mGapEnd - mGapStart < len)
+                grow(len);
+
+            memcpy(&mBuffer[mGapStart], text, len);
+            mGapStart += len;
+
+            update_lines(from, to, text, len);
+            ++mVersion;
+            mTextValid = false;
+
+            if (preamble)
+                update_preamble();
+
+            return true;
+        }
+
+        /** Returns the complete text, valid until the next edit */
+        const std::string& text() {
+            if (!mTextValid) {
+                mText.assign(mBuffer.data(), mGapStart);
+                mText.append(mBuffer.data() + mGapEnd, mBuffer.size() - mGapEnd);
+                mTextValid = true;
+            }
+
+            return mText;
+        }
+
+        /** Returns the number of bytes */
+        std::size_t size() const noexcept {
+            return mBuffer.size() - (mGapEnd - mGapStart);
+        }
+
+        /** Returns a number that changes with every edit */
+        uint64_t version() const noexcept {
+            return mVersion;
+        }
+
+        /** Returns the byte offset one past the preamble */
+        std::size_t preamble_end() const noexcept {
+            return mPreambleEnd;
+        }
+
+        /** Returns a hash of the preamble text */
+        uint64_t preamble_hash() const noexcept {
+            return mPreambleHash;
+        }
+
+        /** Returns a number that changes whenever the preamble text changes */
+        uint64_t preamble_revision() const noexcept {
+            return mPreambleRevision;
+        }
+
+        /** Returns the text of a line without its line break */
+        std::string line(uint32_t line) const {
+            std::string ret;
+            if (line >= mLines.size())
+                return ret;
+
+            std::size_t end = line + 1 < mLines.size() ? mLines[line + 1] : size();
+            for (std::size_t i = mLines[line]; i < end; ++i) {
+                char c = at(i);
+                if (c != '\n' && c != '\r')
+                    ret += c;
+            }
+
+            return ret;
+        }
+
+        /** Returns the length of the preamble of text, see document */
+        static std::size_t preamble_length(const char* text, std::size_t len) {
+            std::size_t end = 0;
+            bool comment = false;
+            bool continued = false;
+
+            for (std::size_t pos = 0; pos < len;) {
+                std::size_t eol = pos;
+                while (eol < len && text[eol] != '\n')
+                    ++eol;
+
+                // first non-whitespace character of the line
+                std::size_t c = pos;
+                while (c < eol && (text[c] == ' ' || text[c] == '\t' || text[c] == '\r'))
+                    ++c;
+
+                bool inPreamble = comment || continued || c == eol || text[c] == '#' ||
+                    (c + 1 < eol && text[c] == '/' && (text[c + 1] == '/' || text[c + 1] == '*'));
+                if (!inPreamble)
+                    break;
+
+                // directives continued with a backslash
+                std::size_t last = eol;
+                while (last > c && text[last - 1] == '\r')
+                    --last;
+                continued = last > c && text[last - 1] == '\\';
+
+                // track block comments spanning multiple lines
+                if (!comment && c + 1 < eol && text[c] == '/' && text[c + 1] == '*') {
+                    comment = true;
+                    c += 2;
+                }
+
+                if (comment) {
+                    for (; c + 1 < eol; ++c) {
+                        if (text[c] == '*' && text[c + 1] == '/') {
+                            comment = false;
+                            break;
+                        }
+                    }
+                }
+
+                pos = eol < len ? eol + 1 : eol;
+                end = pos;
+            }
+
+            return end;
+        }
+    private:
+        /** Size of the gap after a resize */
+        static const std::size_t gap_size = 4096;
+
+        /** Gap buffer */
+        std::vector<char> mBuffer;
+        /** Start of the gap */
+        std::size_t mGapStart;
+        /** End of the gap */
+        std::size_t mGapEnd;
+        /** Byte offset of each line start */
+        std::vector<std::size_t> mLines;
+        /** Contiguous copy of the text */
+        std::string mText;
+        /** Whether mText is up to date */
+        bool mTextValid;
+        /** Edit counter */
+        uint64_t mVersion;
+        /** End of the preamble */
+        std::size_t mPreambleEnd;
+        /** Hash of the preamble */
+        uint64_t mPreambleHash;
+        /** Preamble revision */
+        uint64_t mPreambleRevision;
+
+        /** Returns the character at a logical offset */
+        char at(std::size_t i) const noexcept {
+            return i < mGapStart ? mBuffer[i] : mBuffer[i + (mGapEnd - mGapStart)];
+        }
+
+        /** Converts a position to a byte offset, returns false if the position is out of range */
+        bool offset(text_position pos, std::size_t& ret) const noexcept {
+            if (pos.line > mLines.size())
+                return false;
+
+            // one past the last line refers to the end of the document
+            if (pos.line == mLines.size()) {
+                ret = size();
+                return pos.character == 0;
+            }
+
+            std::size_t end = pos.line + 1 < mLines.size() ? mLines[pos.line + 1] : size();
+            std::size_t i = mLines[pos.line];
+
+            // count UTF-16 code units, code points beyond the BMP take two
+            for (uint32_t units = 0; units < pos.character; ) {
+                if (i >= end || at(i) == '\n')
+                    return false;
+
+                unsigned char c = at(i);
+                std::size_t bytes = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+                units += bytes == 4 ? 2 : 1;
+                i = std::min(i + bytes, end);
+            }
+
+            ret = i;
+            return true;
+        }
+
+        /** Moves the gap to a logical offset */
+        void move_gap(std::size_t pos) {
+            if (pos < mGapStart) {
+                std::size_t num = mGapStart - pos;
+                memmove(&mBuffer[mGapEnd - num], &mBuffer[pos], num);
+                mGapStart -= num;
+                mGapEnd -= num;
+            } else if (pos > mGapStart) {
+                std::size_t num = pos - mGapStart;
+                memmove(&mBuffer[mGapStart], &mBuffer[mGapEnd], num);
+                mGapStart += num;
+                mGapEnd += num;
+            }
+        }
+
+        /** Grows the gap to hold at least len bytes */
+        void grow(std::size_t len) {
+            std::size_t tail = mBuffer.size() - mGapEnd;
+            std::size_t size = mGapStart + len + gap_size + tail;
+
+            std::vector<char> buffer(size);
+            memcpy(buffer.data(), mBuffer.data(), mGapStart);
+            memcpy(buffer.data() + size - tail, mBuffer.data() + mGapEnd, tail);
+
+            mBuffer.swap(buffer);
+            mGapEnd = size - tail;
+        }
+
+        /** Recomputes all line starts */
+        void rebuild_lines() {
+            mLines.assign(1, 0);
+            for (std::size_t i = 0, num = size(); i < num; ++i) {
+                if (at(i) == '\n')
+                    mLines.push_back(i + 1);
+            }
+        }
+
+        /** Updates line starts after [from, to) has been replaced by text */
+        void update_lines(std::size_t from, std::size_t to, const char* text, std::size_t len) {
+            // drop lines starting inside the replaced range
+            auto first = std::upper_bound(mLines.begin(), mLines.end(), from);
+            auto last = std::upper_bound(first, mLines.end(), to);
+            std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(len) - static_cast<std::ptrdiff_t>(to - from);
+
+            for (auto it = last; it != mLines.end(); ++it)
+                *it += delta;
+
+            std::vector<std::size_t> inserted;
+            for (std::size_t i = 0; i < len; ++i) {
+                if (text[i] == '\n')
+                    inserted.push_back(from + i + 1);
+            }
+
+            first = mLines.erase(first, last);
+            mLines.insert(first, inserted.begin(), inserted.end());
+        }
+
+        /** Recomputes the preamble bounds and bumps the revision if its text changed */
+        void update_preamble() {
+            const std::string& str = text();
+            mPreambleEnd = preamble_length(str.data(), str.size());
+
+            // FNV-1a
+            uint64_t hash = 14695981039346656037ull;
+            for (std::size_t i = 0; i < mPreambleEnd; ++i) {
+                hash ^= static_cast<unsigned char>(str[i]);
+                hash *= 1099511628211ull;
+            }
+
+            if (hash != mPreambleHash) {
+                mPreambleHash = hash;
+                ++mPreambleRevision;
+            }
+        }
+    };
+}
+
+#endif /* _CLANG_AUTOCOMPLETE_DOCUMENT_HPP_ */
@@ -0,0 +1,467 @@
+/**
+* @file include_index.hpp
+* @author Robin Dietrich <me (at) invokr (dot) org>
+* @version 1.0
+*
+* @par License
+*   clang-autocomplete
+*   Copyright 2015 Robin Dietrich
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License. *
+*/
+
+#ifndef _CLANG_AUTOCOMPLETE_INCLUDE_INDEX_HPP_
+#define _CLANG_AUTOCOMPLETE_INCLUDE_INDEX_HPP_
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace clang_autocomplete {
+    /** A file or directory that can be included */
+    struct include_entry {
+        /** Name of the entry */
+        std::string name;
+        /** Whether the entry is a directory */
+        bool directory;
+    };
+
+    /** Orders entries by name */
+    inline bool operator<(const include_entry& lhs, const include_entry& rhs) {
+        return lhs.name < rhs.name;
+    }
+
+    /**
+     * Cached listing of the include directories of one set of compiler flags.
+     *
+     * The search paths, including the implicit system and resource directories, are asked from the clang
+     * driver once per set of flags. Only the flags affecting the search paths are passed to it. If it can't
+     * be run or its version differs from libclang, only the directories given by flags are known.
+     *
+     * Directories are read the first time they are completed in and kept in memory afterwards. On
+     * Linux, every listed directory is watched with inotify and updated from its events; elsewhere a
+     * directory is read again once its modification time changes.
+     */
+    class include_index {
+    public:
+        /** Constructor */
+        include_index() : mArgs(), mVersion(), mResolved(false), mSystem(false), mQuotePaths(), mPaths(), mDirs(), mWatches(), mFd(-1) {
+#ifdef __linux__
+            mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        }
+
+        /** Destructor, closes the inotify descriptor */
+        ~include_index() {
+            if (mFd >= 0)
+                close(mFd);
+        }
+
+        /** Removed copy constructor */
+        include_index(const include_index&) = delete;
+
+        /** Removed copy assignment operator */
+        include_index& operator=(const include_index&) = delete;
+
+        /** Sets the compiler arguments and the libclang version string, resets the index if they changed */
+        void set_args(const std::vector<std::string>& args, const std::string& version) {
+            if (args == mArgs && version == mVersion)
+                return;
+
+            mArgs = args;
+            mVersion = version;
+            mResolved = false;
+            reset();
+        }
+
+        /** Returns whether the implicit search paths of the compiler are known */
+        bool has_system_paths() {
+            resolve();
+            return mSystem;
+        }
+
+        /** Returns the search paths for angled includes */
+        const std::vector<std::string>& paths() {
+            resolve();
+            return mPaths;
+        }
+
+        /**
+         * Returns all entries in directory relative to the search paths, in search path order.
+         *
+         * For quoted includes, pass the directory of the including file as local. It is searched
+         * first, followed by the -iquote paths. Angled includes pass an empty string.
+         */
+        std::vector<std::pair<std::string, include_entry>> complete(const std::string& local, const std::string& directory) {
+            resolve();
+            refresh();
+
+            std::vector<std::pair<std::string, include_entry>> ret;
+            std::unordered_set<std::string> seen;
+
+            auto collect = [&](const std::string& path) {
+                std::string dir = path;
+                if (!directory.empty())
+                    dir += "/" + directory;
+
+                for (const include_entry& e : list(dir)) {
+                    // the first search path containing a name shadows all later ones
+                    if (seen.insert(e.name).second)
+                        ret.push_back({dir + "/" + e.name, e});
+                }
+            };
+
+            if (!local.empty()) {
+                collect(local);
+                for (const std::string& path : mQuotePaths)
+                    collect(path);
+            }
+
+            for (const std::string& path : mPaths)
+                collect(path);
+
+            return ret;
+        }
+    private:
+        /** A cached directory listing */
+        struct directory_entry {
+            /** Sorted entries */
+            std::vector<include_entry> entries;
+            /** Modification time when the listing was read */
+            time_t modified;
+            /** inotify watch descriptor, -1 if unwatched */
+            int watch;
+        };
+
+        /** Compiler arguments */
+        std::vector<std::string> mArgs;
+        /** Version of libclang as returned by clang_getClangVersion */
+        std::string mVersion;
+        /** Whether the search paths of mArgs have been determined */
+        bool mResolved;
+        /** Whether the search paths include the implicit ones */
+        bool mSystem;
+        /** Additional search paths for quoted includes */
+        std::vector<std::string> mQuotePaths;
+        /** Search paths for angled includes */
+        std::vector<std::string> mPaths;
+        /** Cached listings by path */
+        std::unordered_map<std::string, directory_entry> mDirs;
+        /** Paths by watch descriptor */
+        std::unordered_map<int, std::string> mWatches;
+        /** inotify descriptor, -1 if unavailable */
+        int mFd;
+
+        /** Determines the search paths for mArgs if that hasn't been done yet */
+        void resolve() {
+            if (mResolved)
+                return;
+
+            mResolved = true;
+            mQuotePaths.clear();
+            mPaths.clear();
+            mSystem = query_driver();
+
+            if (!mSystem)
+                extract_paths();
+        }
+
+        /** Returns the major and minor version following "clang version" in str, empty if there is none */
+        static std::string release(const std::string& str) {
+            static const std::string prefix = "clang version ";
+
+            std::size_t pos = str.find(prefix);
+            if (pos == std::string::npos)
+                return std::string();
+
+            std::string ret;
+            int dots = 0;
+
+            for (pos += prefix.size(); pos < str.size(); ++pos) {
+                if (str[pos] == '.' && ++dots == 2)
+                    break;
+
+                if (str[pos] != '.' && (str[pos] < '0' || str[pos] > '9'))
+                    break;
+
+                ret += str[pos];
+            }
+
+            return ret;
+        }
+
+        /** Returns the arguments in mArgs that affect the search paths, others might write files or fail */
+        std::vector<std::string> driver_args() const {
+            // flags followed by their value as a separate argument
+            static const char* separate[] = {"-I", "-isystem", "-iquote", "-idirafter", "-isysroot", "--sysroot",
+                "-target", "-x", "-resource-dir"};
+            // flags with their value attached
+            static const char* joined[] = {"-I", "-isystem", "-iquote", "-idirafter", "-isysroot", "--sysroot=",
+                "--target=", "-x", "-resource-dir=", "-std=", "-stdlib=", "-nostdinc", "-nostdlibinc"};
+
+            std::vector<std::string> ret;
+
+            for (std::size_t i = 0; i < mArgs.size(); ++i) {
+                const std::string& arg = mArgs[i];
+
+                auto exact = std::find_if(std::begin(separate), std::end(separate), [&arg](const char* flag) {
+                    return arg == flag;
+                });
+
+                if (exact != std::end(separate)) {
+                    ret.push_back(arg);
+                    if (i + 1 < mArgs.size())
+                        ret.push_back(mArgs[++i]);
+
+                    continue;
+                }
+
+                auto prefix = std::find_if(std::begin(joined), std::end(joined), [&arg](const char* flag) {
+                    return arg.compare(0, strlen(flag), flag) == 0;
+                });
+
+                if (prefix != std::end(joined))
+                    ret.push_back(arg);
+            }
+
+            return ret;
+        }
+
+        /** Parses the search paths printed by clang -v, returns false if the driver can't be run or doesn't match libclang */
+        bool query_driver() {
+            std::string cmd = "clang -x c++";
+            for (const std::string& arg : driver_args()) {
+                cmd += " '";
+                for (char c : arg)
+                    cmd += c == '\'' ? std::string("'\\''") : std::string(1, c);
+                cmd += "'";
+            }
+
+            cmd += " -fsyntax-only -v - < /dev/null 2>&1";
+
+            FILE* out = popen(cmd.c_str(), "r");
+            if (!out)
+                return false;
+
+            std::vector<std::string>* target = nullptr;
+            std::string version;
+            bool done = false;
+            char buf[4096];
+
+            while (fgets(buf, sizeof(buf), out)) {
+                std::string line(buf);
+                while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+                    line.pop_back();
+
+                if (version.empty() && line.find("clang version ") != std::string::npos) {
+                    version = release(line);
+                } else if (line.compare(0, 9, "#include ") == 0) {
+                    target = line.find('<') != std::string::npos ? &mPaths : &mQuotePaths;
+                } else if (line == "End of search list.") {
+                    done = true;
+                    target = nullptr;
+                } else if (target && !line.empty() && line[0] == ' ') {
+                    // macOS marks framework directories, those don't contain plain headers
+                    if (line.find(" (framework directory)") == std::string::npos)
+                        target->push_back(line.substr(1));
+                }
+            }
+
+            pclose(out);
+
+            // the implicit paths of another release contain headers libclang can't parse
+            if (!mVersion.empty() && version != release(mVersion))
+                done = false;
+
+            if (!done) {
+                mQuotePaths.clear();
+                mPaths.clear();
+            }
+
+            return done;
+        }
+
+        /** Takes the search paths from -iquote, -I, -isystem and -idirafter flags */
+        void extract_paths() {
+            static const char* flags[] = {"-iquote", "-isystem", "-idirafter", "-I"};
+
+            for (std::size_t i = 0; i < mArgs.size(); ++i) {
+                for (const char* flag : flags) {
+                    std::size_t len = strlen(flag);
+                    if (mArgs[i].compare(0, len, flag) != 0)
+                        continue;
+
+                    std::vector<std::string>& target = flag == flags[0] ? mQuotePaths : mPaths;
+                    if (mArgs[i].size() > len)
+                        target.push_back(mArgs[i].substr(len));
+                    else if (i + 1 < mArgs.size())
+                        target.push_back(mArgs[++i]);
+
+                    break;
+                }
+            }
+        }
+
+        /** Drops all cached directories */
+        void reset() {
+#ifdef __linux__
+            for (auto& w : mWatches)
+                inotify_rm_watch(mFd, w.first);
+#endif
+
+            mWatches.clear();
+            mDirs.clear();
+        }
+
+        /** Returns the listing of dir, reading it if it isn't cached */
+        const std::vector<include_entry>& list(const std::string& dir) {
+            static const std::vector<include_entry> empty;
+
+            struct stat st;
+            auto it = mDirs.find(dir);
+
+            if (it != mDirs.end()) {
+                // without inotify, a changed modification time means the listing is outdated
+                if (it->second.watch >= 0 || (stat(dir.c_str(), &st) == 0 && st.st_mtime == it->second.modified))
+                    return it->second.entries;
+
+                mDirs.erase(it);
+            }
+
+            if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+                return empty;
+
+            directory_entry d;
+            d.modified = st.st_mtime;
+            d.watch = -1;
+
+#ifdef __linux__
+            // watch before reading so no change can slip through in between
+            if (mFd >= 0) {
+                d.watch = inotify_add_watch(mFd, dir.c_str(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+            }
+#endif
+
+            DIR* handle = opendir(dir.c_str());
+            if (!handle) {
+#ifdef __linux__
+                if (d.watch >= 0 && !mWatches.count(d.watch))
+                    inotify_rm_watch(mFd, d.watch);
+#endif
+                return empty;
+            }
+
+            while (dirent* e = readdir(handle)) {
+                if (e->d_name[0] == '.')
+                    continue;
+
+                bool directory = e->d_type == DT_DIR;
+                if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) {
+                    struct stat es;
+                    directory = stat((dir + "/" + e->d_name).c_str(), &es) == 0 && S_ISDIR(es.st_mode);
+                }
+
+                d.entries.push_back({e->d_name, directory});
+            }
+
+            closedir(handle);
+            std::sort(d.entries.begin(), d.entries.end());
+
+            if (d.watch >= 0) {
+                // several paths can resolve to the same watch, only keep one listing for it
+                auto w = mWatches.find(d.watch);
+                if (w != mWatches.end() && w->second != dir)
+                    mDirs.erase(w->second);
+
+                mWatches[d.watch] = dir;
+            }
+
+            return mDirs.emplace(dir, std::move(d)).first->second.entries;
+        }
+
+        /** Applies all pending inotify events */
+        void refresh() {
+#ifdef __linux__
+            if (mFd < 0)
+                return;
+
+            alignas(inotify_event) char buf[4096];
+            ssize_t len;
+
+            while ((len = read(mFd, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + len; p += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(p)->len) {
+                    const inotify_event* ev = reinterpret_cast<inotify_event*>(p);
+
+                    if (ev->mask & IN_Q_OVERFLOW) {
+                        reset();
+                        continue;
+                    }
+
+                    auto w = mWatches.find(ev->wd);
+                    if (w == mWatches.end())
+                        continue;
+
+                    auto d = mDirs.find(w->second);
+                    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                        if (d != mDirs.end())
+                            mDirs.erase(d);
+
+                        if (!(ev->mask & IN_IGNORED))
+                            inotify_rm_watch(mFd, ev->wd);
+
+                        mWatches.erase(w);
+                        continue;
+                    }
+
+                    if (d == mDirs.end() || !ev->len || ev->name[0] == '.')
+                        continue;
+
+                    std::vector<include_entry>& entries = d->second.entries;
+                    include_entry e = {ev->name, (ev->mask & IN_ISDIR) != 0};
+                    auto it = std::lower_bound(entries.begin(), entries.end(), e);
+                    bool exists = it != entries.end() && it->name == e.name;
+
+                    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                        if (exists)
+                            it->directory = e.directory;
+                        else
+                            entries.insert(it, e);
+                    } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                        if (exists)
+                            entries.erase(it);
+                    }
+                }
+            }
+#endif
+        }
+    };
+}
+
+#endif /* _CLANG_AUTOCOMPLETE_INCLUDE_INDEX_HPP_ */
@@ -0,0 +1,214 @@
+/**
+* @file trace.hpp
+* @author Robin Dietrich <me (at) invokr (dot) org>
+* @version 1.0
+*
+* @par License
+*   clang-autocomplete
+*   Copyright 2015 Robin Dietrich
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License. *
+*/
+
+#ifndef _CLANG_AUTOCOMPLETE_TRACE_HPP_
+#define _CLANG_AUTOCOMPLETE_TRACE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <unistd.h>
+
+namespace clang_autocomplete {
+    /** Records timed spans into a fixed size ring buffer and exports them as Chrome trace events */
+    class tracer {
+    public:
+        /** A single completed span */
+        struct span {
+            /** Name of the operation, must be a string literal */
+            const char* name;
+            /** File the operation worked on */
+            std::string file;
+            /** Start time in microseconds */
+            uint64_t start;
+            /** Duration in microseconds */
+            uint64_t duration;
+            /** Id of the recording thread, see thread_id() */
+            uint32_t tid;
+        };
+
+        /** Constructor, tracing is disabled by default */
+        tracer() : mSpans(), mNext(0), mCount(0), mLock() {
+
+        }
+
+        /** Removed copy constructor */
+        tracer(const tracer&) = delete;
+
+        /** Removed copy assignment operator */
+        tracer& operator=(const tracer&) = delete;
+
+        /** Returns the current time in microseconds */
+        static uint64_t now() noexcept {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /** Returns a small id for the calling thread, threads are numbered in order of their first span */
+        static uint32_t thread_id() {
+            static std::atomic<uint32_t> next(1);
+            static thread_local uint32_t id = next++;
+            return id;
+        }
+
+        /** Returns whether spans are being recorded */
+        bool enabled() const noexcept {
+            return !mSpans.empty();
+        }
+
+        /** Sets the maximum number of retained spans, 0 disables tracing and drops all spans */
+        void set_capacity(std::size_t capacity) {
+            std::lock_guard<std::mutex> lock(mLock);
+            mSpans.clear();
+            mSpans.shrink_to_fit();
+            mSpans.resize(capacity);
+            mNext = 0;
+            mCount = 0;
+        }
+
+        /** Returns the maximum number of retained spans */
+        std::size_t get_capacity() const noexcept {
+            return mSpans.size();
+        }
+
+        /** Records a span, overwriting the oldest one if the buffer is full */
+        void record(const char* name, const std::string& file, uint64_t start, uint64_t end) {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (mSpans.empty())
+                return;
+
+            span& s = mSpans[mNext];
+            s.name = name;
+            s.file.assign(file); // reuses the capacity of the overwritten span
+            s.start = start;
+            s.duration = end - start;
+            s.tid = thread_id();
+
+            mNext = (mNext + 1) % mSpans.size();
+            if (mCount < mSpans.size())
+                ++mCount;
+        }
+
+        /** Writes all retained spans to path in Chrome's trace event format, returns false on failure */
+        bool write(const std::string& path) {
+            std::lock_guard<std::mutex> lock(mLock);
+            std::ofstream out(path.c_str(), std::ios::out | std::ios::trunc);
+            if (!out)
+                return false;
+
+            out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+            // oldest span first
+            std::size_t first = (mNext + mSpans.size() - mCount) % (mSpans.empty() ? 1 : mSpans.size());
+            for (std::size_t i = 0; i < mCount; ++i) {
+                const span& s = mSpans[(first + i) % mSpans.size()];
+
+                if (i)
+                    out << ",";
+
+                out << "\n{\"name\":\"" << s.name << "\",\"cat\":\"clang\",\"ph\":\"X\""
+                    << ",\"ts\":" << s.start << ",\"dur\":" << s.duration
+                    << ",\"pid\":" << getpid() << ",\"tid\":" << s.tid
+                    << ",\"args\":{\"file\":\"" << escape(s.file) << "\"}}";
+            }
+
+            out << "\n]}\n";
+            return static_cast<bool>(out);
+        }
+    private:
+        /** Ring buffer of spans */
+        std::vector<span> mSpans;
+        /** Index the next span is written to */
+        std::size_t mNext;
+        /** Number of valid spans */
+        std::size_t mCount;
+        /** Guards the ring buffer */
+        std::mutex mLock;
+
+        /** Escapes a string for use in JSON */
+        static std::string escape(const std::string& str) {
+            std::string ret;
+            ret.reserve(str.size());
+
+            for (char c : str) {
+                switch (c) {
+                case '"':  ret += "\\\""; break;
+                case '\\': ret += "\\\\"; break;
+                case '\n': ret += "\\n"; break;
+                case '\t': ret += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        ret += buf;
+                    } else {
+                        ret += c;
+                    }
+                    break;
+                }
+            }
+
+            return ret;
+        }
+    };
+
+    /** Records a span covering the lifetime of this object */
+    class trace_scope {
+    public:
+        /** Starts the span if tracing is enabled */
+        trace_scope(tracer& t, const char* name, const std::string& file)
+            : mTracer(t), mName(name), mFile(file), mStart(t.enabled() ? tracer::now() : 0) {
+
+        }
+
+        /** Ends the span */
+        ~trace_scope() {
+            if (mStart && mTracer.enabled())
+                mTracer.record(mName, mFile, mStart, tracer::now());
+        }
+
+        /** Removed copy constructor */
+        trace_scope(const trace_scope&) = delete;
+
+        /** Removed copy assignment operator */
+        trace_scope& operator=(const trace_scope&) = delete;
+    private:
+        /** Tracer the span is recorded in */
+        tracer& mTracer;
+        /** Name of the span */
+        const char* mName;
+        /** File the span belongs to */
+        const std::string& mFile;
+        /** Start time, 0 if tracing was disabled */
+        uint64_t mStart;
+    };
+}
+
+#endif /* _CLANG_AUTOCOMPLETE_TRACE_HPP_ */
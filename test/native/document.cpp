@@ -0,0 +1,215 @@
+/**
+* @file document.cpp
+* @author Robin Dietrich <me (at) invokr (dot) org>
+* @version 1.0
+*
+* @par License
+*   clang-autocomplete
+*   Copyright 2015 Robin Dietrich
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License. *
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "document.hpp"
+
+using namespace clang_autocomplete;
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+/** Creates a document from a string */
+static document make(const std::string& text) {
+    return document(text.data(), text.size());
+}
+
+/** Applies an edit given as line/character pairs */
+static bool edit(document& doc, uint32_t l1, uint32_t c1, uint32_t l2, uint32_t c2, const std::string& text) {
+    return doc.edit({l1, c1}, {l2, c2}, text.data(), text.size());
+}
+
+/** Replacing a range spanning lines with text spanning lines */
+static void test_multiline_replace() {
+    document doc = make("one\ntwo\nthree\n");
+
+    CHECK(edit(doc, 0, 1, 1, 2, "N\nX\nY"));
+    CHECK(doc.text() == "oN\nX\nYo\nthree\n");
+    CHECK(doc.line(0) == "oN");
+    CHECK(doc.line(1) == "X");
+    CHECK(doc.line(2) == "Yo");
+    CHECK(doc.line(3) == "three");
+    CHECK(doc.line(4) == "");
+
+    // line starts behind the edit have been shifted
+    CHECK(edit(doc, 3, 5, 3, 5, "!"));
+    CHECK(doc.text() == "oN\nX\nYo\nthree!\n");
+}
+
+/** Deleting ranges that contain line breaks */
+static void test_delete_across_lines() {
+    document doc = make("a\nbb\nccc\ndddd");
+
+    CHECK(edit(doc, 0, 1, 2, 1, ""));
+    CHECK(doc.text() == "acc\ndddd");
+    CHECK(doc.line(0) == "acc");
+    CHECK(doc.line(1) == "dddd");
+    CHECK(doc.size() == 8);
+
+    CHECK(edit(doc, 0, 0, 1, 4, ""));
+    CHECK(doc.text() == "");
+    CHECK(doc.line(0) == "");
+
+    // reversed ranges are rejected
+    document other = make("abc\ndef");
+    CHECK(!edit(other, 1, 0, 0, 1, ""));
+    CHECK(other.text() == "abc\ndef");
+}
+
+/** Characters count UTF-16 code units, code points beyond the BMP take two */
+static void test_utf16() {
+    // U+00E9 takes two bytes and one unit, U+1F600 takes four bytes and two units
+    document doc = make("\xC3\xA9x\xF0\x9F\x98\x80y\n");
+
+    CHECK(edit(doc, 0, 1, 0, 2, "X"));
+    CHECK(doc.text() == "\xC3\xA9X\xF0\x9F\x98\x80y\n");
+
+    CHECK(edit(doc, 0, 4, 0, 4, "Z"));
+    CHECK(doc.text() == "\xC3\xA9X\xF0\x9F\x98\x80Zy\n");
+
+    CHECK(edit(doc, 0, 2, 0, 4, ""));
+    CHECK(doc.text() == "\xC3\xA9XZy\n");
+
+    // past the end of the line
+    CHECK(!edit(doc, 0, 5, 0, 5, "?"));
+}
+
+/** Positions at the end of lines and of the document */
+static void test_end_positions() {
+    document doc = make("ab\ncd");
+
+    CHECK(edit(doc, 1, 2, 1, 2, "e"));
+    CHECK(doc.text() == "ab\ncde");
+
+    CHECK(edit(doc, 0, 2, 0, 2, "!"));
+    CHECK(doc.text() == "ab!\ncde");
+
+    // one line past the last one refers to the end of the document
+    document nl = make("ab\n");
+    CHECK(edit(nl, 1, 0, 1, 0, "cd"));
+    CHECK(nl.text() == "ab\ncd");
+    CHECK(edit(nl, 2, 0, 2, 0, "\n"));
+    CHECK(nl.text() == "ab\ncd\n");
+    CHECK(!edit(nl, 2, 1, 2, 1, "x"));
+    CHECK(!edit(nl, 4, 0, 4, 0, "x"));
+}
+
+/** Inserting more than the gap holds */
+static void test_growth() {
+    document doc = make("begin\nend\n");
+    std::string big(10000, 'x');
+
+    CHECK(edit(doc, 1, 0, 1, 0, big + "\n"));
+    CHECK(doc.size() == 20 + big.size() - 9);
+    CHECK(doc.line(1) == big);
+    CHECK(doc.line(2) == "end");
+}
+
+/** Random edits compared against a plain string */
+static void test_random() {
+    std::string model = "int main() {\n    return 0;\n}\n";
+    document doc = make(model);
+    srand(42);
+
+    for (int i = 0; i < 2000; ++i) {
+        std::size_t from = rand() % (model.size() + 1);
+        std::size_t to = from + rand() % (model.size() - from + 1);
+        if (to - from > 8)
+            to = from + 8;
+
+        static const char* inserts[] = {"", "a", "\n", "xy\nz", "\n\n", "#include <v>\n"};
+        std::string text = inserts[rand() % 6];
+
+        // convert the byte offsets of the ASCII model to positions
+        auto position = [&model](std::size_t offset) -> text_position {
+            std::size_t start = model.rfind('\n', offset ? offset - 1 : std::string::npos);
+            start = (offset == 0 || start == std::string::npos) ? 0 : start + 1;
+            uint32_t line = 0;
+            for (std::size_t j = 0; j < start; ++j)
+                line += model[j] == '\n';
+            return {line, static_cast<uint32_t>(offset - start)};
+        };
+
+        CHECK(doc.edit(position(from), position(to), text.data(), text.size()));
+        model.replace(from, to - from, text);
+
+        if (doc.text() != model) {
+            CHECK(doc.text() == model);
+            return;
+        }
+    }
+
+    std::size_t line = 0;
+    for (std::size_t start = 0; start <= model.size(); ++line) {
+        std::size_t end = model.find('\n', start);
+        if (end == std::string::npos)
+            end = model.size();
+
+        CHECK(doc.line(line) == model.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+/** The preamble revision only changes with the text of the preamble */
+static void test_preamble() {
+    document doc = make("#include <a>\n\nint x;\nint y;\n");
+    uint64_t revision = doc.preamble_revision();
+    CHECK(doc.preamble_end() == 14);
+
+    CHECK(edit(doc, 3, 4, 3, 5, "z"));
+    CHECK(doc.preamble_revision() == revision);
+
+    CHECK(edit(doc, 0, 10, 0, 11, "b"));
+    CHECK(doc.preamble_revision() != revision);
+
+    // turning the indented first code line into a directive extends the preamble
+    document indented = make("#include <a>\n    int x;\nint y;\n");
+    revision = indented.preamble_revision();
+    CHECK(edit(indented, 1, 4, 1, 10, "#include <b>"));
+    CHECK(indented.preamble_revision() != revision);
+    CHECK(indented.preamble_end() == 30);
+
+    std::string text = "/* a\nb */\n#define X \\\n  1\nint";
+    CHECK(document::preamble_length(text.data(), text.size()) == text.size() - 3);
+}
+
+int main() {
+    test_multiline_replace();
+    test_delete_across_lines();
+    test_utf16();
+    test_end_positions();
+    test_growth();
+    test_random();
+    test_preamble();
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("document: all checks passed\n");
+    return 0;
+}
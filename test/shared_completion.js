@@ -0,0 +1,94 @@
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var clang_autocomplete = require('../.');
+
+// Writes a file with the single line decl ahead of main, completes after "std::" in line 5, column 10
+function source(dir, name, decl) {
+    var file = path.join(dir, name);
+    fs.writeFileSync(file, '#include <vector>\n\n' + decl + '\nint main() {\n    std::\n}\n');
+    return file;
+}
+
+function count(results, name) {
+    return results.filter(function (r) { return r.name === name; }).length;
+}
+
+function names(results) {
+    return results.map(function (r) { return r.name; });
+}
+
+exports.sharedNamespaceCompletion = function (test) {
+    var dir = fs.mkdtempSync(path.join(os.tmpdir(), 'clang-autocomplete-'));
+    var a = source(dir, 'a.cpp', 'int global;');
+    var b = source(dir, 'b.cpp', 'int global;');
+    var c = source(dir, 'c.cpp', 'namespace std { int local_c; }');
+
+    var lib = new clang_autocomplete.lib();
+    lib.arguments = ['-std=c++11'];
+    lib.tracing = 1000;
+
+    var resA = names(lib.complete(a, 5, 10));
+    var resB = names(lib.complete(b, 5, 10));
+    var resC = names(lib.complete(c, 5, 10));
+    var resA2 = names(lib.complete(a, 5, 10));
+
+    test.ok(resA.indexOf('vector') >= 0, 'std::vector is completed');
+    test.deepEqual(resB.sort(), resA.slice().sort(), 'same preamble, same results');
+    test.ok(resC.indexOf('local_c') >= 0, 'file-local members are merged in');
+    test.ok(resC.indexOf('vector') >= 0, 'shared members are merged in');
+    test.ok(resA2.indexOf('local_c') < 0, 'file-local members are not shared');
+
+    // Only the first request completes the headers, everything after it is answered from the shared results
+    var trace = path.join(dir, 'trace.json');
+    lib.writeTrace(trace);
+    var events = JSON.parse(fs.readFileSync(trace, 'utf8')).traceEvents;
+    var files = function (name) {
+        return events.filter(function (e) { return e.name === name; }).map(function (e) { return e.args.file; });
+    };
+
+    test.deepEqual(files('codeCompleteShared'), [a]);
+    test.deepEqual(files('mergeShared'), [a, b, c, a]);
+    test.deepEqual(files('codeComplete'), []);
+    test.done();
+};
+
+exports.localOverloadKeepsSharedOverloads = function (test) {
+    var dir = fs.mkdtempSync(path.join(os.tmpdir(), 'clang-autocomplete-'));
+    var a = source(dir, 'a.cpp', 'int global;');
+    var d = source(dir, 'd.cpp', 'namespace std { struct Foo {}; void swap(Foo&, Foo&); }');
+
+    var lib = new clang_autocomplete.lib();
+    lib.arguments = ['-std=c++11'];
+
+    // The overload declared in d.cpp must neither keep the header ones out of the shared results
+    // nor hide them when they are merged back in
+    var resD = lib.complete(d, 5, 10);
+    var resA = lib.complete(a, 5, 10);
+    var resD2 = lib.complete(d, 5, 10);
+
+    test.ok(count(resA, 'swap') > 0, 'header overloads are shared');
+    test.equal(count(resD2, 'swap'), count(resD, 'swap'), 'local overload is merged next to the shared ones');
+    test.ok(count(resD2, 'swap') > count(resA, 'swap'), 'local overload is not shared');
+    test.done();
+};
+
+exports.memberAccessIsNotShared = function (test) {
+    var dir = fs.mkdtempSync(path.join(os.tmpdir(), 'clang-autocomplete-'));
+    var file = path.join(dir, 'member.cpp');
+    fs.writeFileSync(file, '#include <vector>\n\nint main() {\n    std::vector<int> v; v.\n}\n');
+
+    var lib = new clang_autocomplete.lib();
+    lib.arguments = ['-std=c++11'];
+    lib.tracing = 1000;
+
+    test.ok(names(lib.complete(file, 4, 27)).indexOf('push_back') >= 0);
+
+    // A single completion without the file-local pass
+    var trace = path.join(dir, 'trace.json');
+    lib.writeTrace(trace);
+    var spans = JSON.parse(fs.readFileSync(trace, 'utf8')).traceEvents.map(function (e) { return e.name; });
+    test.equal(spans.filter(function (n) { return n === 'codeComplete'; }).length, 1);
+    test.equal(spans.indexOf('codeCompleteLocal'), -1);
+    test.done();
+};